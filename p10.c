@@ -0,0 +1,556 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/ptrace.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/user.h>
+#include <sys/uio.h>
+#include <sys/procfs.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <signal.h>
+#include <time.h>
+
+/**
+ * Takes a snapshot of a running process and writes it as an ELF core
+ * file, on x86_64. The result can be opened with `gdb <exe> <core>`.
+ *
+ * I wanted to see how short the pause of the tracee can be made. gcore
+ * reads the memory through the tracer one piece at a time, while the
+ * whole process is stopped. Here, every thread is attached with
+ * PTRACE_SEIZE and stopped with PTRACE_INTERRUPT just like in p07.c,
+ * but since PTRACE_INTERRUPT only applies to a single thread, we need
+ * to walk /proc/<pid>/task. A thread can clone a new one before it
+ * gets stopped, so we keep rescanning until no new threads show up.
+ *
+ * Once everything is stopped, the registers of each thread are saved
+ * and the readable mappings in /proc/<pid>/maps are copied with
+ * process_vm_readv by a number of worker threads. This reads directly
+ * from the address space of the tracee without going through ptrace
+ * one word at a time as in p06.c. Pages that are all zero are never
+ * written, so the core file ends up sparse. The tracee is detached
+ * (and thereby resumed) as soon as the copy is done.
+ *
+ * With -l, mappings that are not writable are copied only after the
+ * tracee has been resumed. They normally contain code and read-only
+ * data that the tracee can't change, but this is not guaranteed since
+ * it could mprotect them, so that part of the snapshot is a bit
+ * optimistic.
+ *
+ * If a thread was in a signal-delivery-stop instead of the expected
+ * PTRACE_EVENT_STOP, the signal is passed on when detaching.
+ */
+
+#define CHUNK_SIZE (1 << 20)
+#define MAX_THREADS 4096
+
+struct thread {
+    pid_t tid;
+    int signal;
+    struct user_regs_struct regs;
+    struct user_fpregs_struct fpregs;
+};
+
+struct region {
+    unsigned long start;
+    unsigned long end;
+    unsigned long pgoff;
+    int flags;
+    bool late;
+    off_t offset;
+};
+
+struct thread threads[MAX_THREADS];
+int nthreads;
+
+struct region *regions;
+int nregions;
+
+pid_t pid;
+int core_fd;
+long page_size;
+
+/* Shared between the worker threads */
+struct {
+    pthread_mutex_t lock;
+    bool late;
+    int region;
+    unsigned long addr;
+    unsigned long written;
+    unsigned long zero_pages;
+    unsigned long unreadable_pages;
+} work = { PTHREAD_MUTEX_INITIALIZER, false, 0, 0, 0, 0, 0 };
+
+void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-j workers] [-l] <pid> <core-file>\n", name);
+    exit(EXIT_FAILURE);
+}
+
+double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+bool have_thread(pid_t tid)
+{
+    for (int i = 0; i < nthreads; i++) {
+        if (threads[i].tid == tid) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Seizes and interrupts threads we haven't seen before, returns how many */
+int seize_new_threads(void)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/task", pid);
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+
+    int found = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        pid_t tid = atoi(entry->d_name);
+        if (tid <= 0 || have_thread(tid)) {
+            continue;
+        }
+        if (nthreads == MAX_THREADS) {
+            fprintf(stderr, "Too many threads\n");
+            exit(EXIT_FAILURE);
+        }
+        if (ptrace(PTRACE_SEIZE, tid, 0, 0) == -1 ||
+            ptrace(PTRACE_INTERRUPT, tid, 0, 0) == -1) {
+            // The thread may have exited after we read the directory
+            continue;
+        }
+        threads[nthreads].tid = tid;
+        threads[nthreads].signal = 0;
+        nthreads++;
+        found++;
+    }
+    closedir(dir);
+    return found;
+}
+
+void stop_all_threads(void)
+{
+    int waited = 0;
+    while (seize_new_threads() > 0) {
+        for (int i = waited; i < nthreads; i++) {
+            int status;
+            if (waitpid(threads[i].tid, &status, __WALL) == -1) {
+                perror("waitpid");
+                exit(EXIT_FAILURE);
+            }
+            if (WIFEXITED(status) || WIFSIGNALED(status)) {
+                threads[i] = threads[--nthreads];
+                i--;
+                continue;
+            }
+            if (status >> 16 != PTRACE_EVENT_STOP) {
+                threads[i].signal = WSTOPSIG(status);
+            }
+        }
+        waited = nthreads;
+    }
+
+    // Put the thread group leader first; gdb picks the first
+    // NT_PRSTATUS note as the current thread.
+    for (int i = 1; i < nthreads; i++) {
+        if (threads[i].tid == pid) {
+            struct thread tmp = threads[0];
+            threads[0] = threads[i];
+            threads[i] = tmp;
+            break;
+        }
+    }
+
+    for (int i = 0; i < nthreads; i++) {
+        if (ptrace(PTRACE_GETREGS, threads[i].tid, 0, &threads[i].regs) == -1 ||
+            ptrace(PTRACE_GETFPREGS, threads[i].tid, 0,
+                   &threads[i].fpregs) == -1) {
+            // Killed while stopped, leave it out of the core
+            fprintf(stderr, "Thread %d: %s\n", threads[i].tid,
+                    strerror(errno));
+            memmove(&threads[i], &threads[i + 1],
+                    (nthreads - i - 1) * sizeof(threads[0]));
+            nthreads--;
+            i--;
+        }
+    }
+}
+
+void resume_all_threads(void)
+{
+    for (int i = 0; i < nthreads; i++) {
+        ptrace(PTRACE_DETACH, threads[i].tid, 0, threads[i].signal);
+    }
+}
+
+void read_maps(bool split_late)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/maps", pid);
+    FILE *maps = fopen(path, "r");
+    if (maps == NULL) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+
+    char line[4096];
+    int capacity = 0;
+    while (fgets(line, sizeof(line), maps) != NULL) {
+        struct region r;
+        char perms[5];
+        int name_pos = 0;
+        if (sscanf(line, "%lx-%lx %4s %lx %*s %*u %n",
+                   &r.start, &r.end, perms, &r.pgoff, &name_pos) < 4) {
+            continue;
+        }
+        const char *name = line + name_pos;
+        if (perms[0] != 'r' || strncmp(name, "[vvar", 5) == 0 ||
+            strncmp(name, "[vsyscall]", 10) == 0) {
+            continue;
+        }
+
+        r.flags = PF_R;
+        r.flags |= perms[1] == 'w' ? PF_W : 0;
+        r.flags |= perms[2] == 'x' ? PF_X : 0;
+        r.late = split_late && perms[1] != 'w';
+
+        if (nregions == capacity) {
+            capacity = capacity ? capacity * 2 : 256;
+            regions = realloc(regions, capacity * sizeof(*regions));
+            if (regions == NULL) {
+                perror("realloc");
+                exit(EXIT_FAILURE);
+            }
+        }
+        regions[nregions++] = r;
+    }
+    fclose(maps);
+}
+
+void read_proc_file(const char *name, char *buf, size_t size, size_t *len)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/%s", pid, name);
+    *len = 0;
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return;
+    }
+    ssize_t n;
+    while (*len < size && (n = read(fd, buf + *len, size - *len)) > 0) {
+        *len += n;
+    }
+    close(fd);
+}
+
+size_t note_size(size_t descsz)
+{
+    return sizeof(Elf64_Nhdr) + 8 + ((descsz + 3) & ~3UL);
+}
+
+char *put_note(char *p, Elf64_Word type, const void *desc, size_t descsz)
+{
+    Elf64_Nhdr nhdr = { 5, descsz, type };
+    memcpy(p, &nhdr, sizeof(nhdr));
+    memcpy(p + sizeof(nhdr), "CORE\0\0\0", 8);
+    memcpy(p + sizeof(nhdr) + 8, desc, descsz);
+    return p + note_size(descsz);
+}
+
+/* Writes the ELF header, program headers and notes; returns file size */
+off_t write_headers(void)
+{
+    char auxv[4096];
+    size_t auxv_len;
+    read_proc_file("auxv", auxv, sizeof(auxv), &auxv_len);
+
+    size_t notes_size = note_size(sizeof(struct elf_prpsinfo)) +
+        note_size(auxv_len) +
+        nthreads * (note_size(sizeof(struct elf_prstatus)) +
+                    note_size(sizeof(struct user_fpregs_struct)));
+    size_t phdrs_size = (1 + nregions) * sizeof(Elf64_Phdr);
+    size_t headers_size = sizeof(Elf64_Ehdr) + phdrs_size + notes_size;
+
+    char *buf = calloc(1, headers_size);
+    if (buf == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+
+    Elf64_Ehdr *ehdr = (Elf64_Ehdr *)buf;
+    memcpy(ehdr->e_ident, ELFMAG, SELFMAG);
+    ehdr->e_ident[EI_CLASS] = ELFCLASS64;
+    ehdr->e_ident[EI_DATA] = ELFDATA2LSB;
+    ehdr->e_ident[EI_VERSION] = EV_CURRENT;
+    ehdr->e_ident[EI_OSABI] = ELFOSABI_NONE;
+    ehdr->e_type = ET_CORE;
+    ehdr->e_machine = EM_X86_64;
+    ehdr->e_version = EV_CURRENT;
+    ehdr->e_phoff = sizeof(Elf64_Ehdr);
+    ehdr->e_ehsize = sizeof(Elf64_Ehdr);
+    ehdr->e_phentsize = sizeof(Elf64_Phdr);
+    ehdr->e_phnum = 1 + nregions;
+
+    Elf64_Phdr *phdr = (Elf64_Phdr *)(buf + sizeof(Elf64_Ehdr));
+    phdr[0].p_type = PT_NOTE;
+    phdr[0].p_offset = sizeof(Elf64_Ehdr) + phdrs_size;
+    phdr[0].p_filesz = notes_size;
+    phdr[0].p_align = 4;
+
+    off_t offset = (headers_size + page_size - 1) & ~(page_size - 1);
+    for (int i = 0; i < nregions; i++) {
+        struct region *r = &regions[i];
+        r->offset = offset;
+        phdr[1 + i].p_type = PT_LOAD;
+        phdr[1 + i].p_flags = r->flags;
+        phdr[1 + i].p_offset = offset;
+        phdr[1 + i].p_vaddr = r->start;
+        phdr[1 + i].p_filesz = r->end - r->start;
+        phdr[1 + i].p_memsz = r->end - r->start;
+        phdr[1 + i].p_align = page_size;
+        offset += r->end - r->start;
+    }
+
+    char *p = buf + phdr[0].p_offset;
+
+    struct elf_prpsinfo psinfo;
+    memset(&psinfo, 0, sizeof(psinfo));
+    size_t len;
+    psinfo.pr_pid = pid;
+    psinfo.pr_sname = 'R';
+    read_proc_file("comm", psinfo.pr_fname, sizeof(psinfo.pr_fname) - 1, &len);
+    if (len > 0 && psinfo.pr_fname[len - 1] == '\n') {
+        psinfo.pr_fname[len - 1] = '\0';
+    }
+    read_proc_file("cmdline", psinfo.pr_psargs, sizeof(psinfo.pr_psargs) - 1,
+                   &len);
+    for (size_t i = 0; len > 0 && i < len - 1; i++) {
+        if (psinfo.pr_psargs[i] == '\0') {
+            psinfo.pr_psargs[i] = ' ';
+        }
+    }
+    p = put_note(p, NT_PRPSINFO, &psinfo, sizeof(psinfo));
+    p = put_note(p, NT_AUXV, auxv, auxv_len);
+
+    for (int i = 0; i < nthreads; i++) {
+        struct elf_prstatus prstatus;
+        memset(&prstatus, 0, sizeof(prstatus));
+        prstatus.pr_pid = threads[i].tid;
+        prstatus.pr_cursig = threads[i].signal;
+        prstatus.pr_info.si_signo = threads[i].signal;
+        memcpy(&prstatus.pr_reg, &threads[i].regs, sizeof(threads[i].regs));
+        prstatus.pr_fpvalid = 1;
+        p = put_note(p, NT_PRSTATUS, &prstatus, sizeof(prstatus));
+        p = put_note(p, NT_FPREGSET, &threads[i].fpregs,
+                     sizeof(threads[i].fpregs));
+    }
+
+    if (pwrite(core_fd, buf, headers_size, 0) != (ssize_t)headers_size) {
+        perror("pwrite");
+        exit(EXIT_FAILURE);
+    }
+    free(buf);
+    return offset;
+}
+
+/* Picks the next chunk to copy, returns false when there is none left */
+bool next_chunk(int *region, unsigned long *addr, unsigned long *len)
+{
+    bool found = false;
+    pthread_mutex_lock(&work.lock);
+    while (work.region < nregions) {
+        struct region *r = &regions[work.region];
+        if (r->late != work.late || work.addr >= r->end) {
+            work.region++;
+            work.addr = work.region < nregions ? regions[work.region].start : 0;
+            continue;
+        }
+        *region = work.region;
+        *addr = work.addr;
+        *len = r->end - work.addr < CHUNK_SIZE ? r->end - work.addr : CHUNK_SIZE;
+        work.addr += *len;
+        found = true;
+        break;
+    }
+    pthread_mutex_unlock(&work.lock);
+    return found;
+}
+
+bool is_zero(const char *buf, size_t len)
+{
+    const unsigned long *p = (const unsigned long *)buf;
+    for (size_t i = 0; i < len / sizeof(*p); i++) {
+        if (p[i] != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Writes the non-zero pages of buf, coalescing adjacent ones */
+void write_pages(const char *buf, size_t len, off_t offset,
+                 unsigned long *written, unsigned long *zero_pages)
+{
+    size_t run = 0;
+    for (size_t pos = 0; pos <= len; pos += page_size) {
+        if (pos < len && !is_zero(buf + pos, page_size)) {
+            continue;
+        }
+        if (pos > run) {
+            if (pwrite(core_fd, buf + run, pos - run, offset + run) == -1) {
+                perror("pwrite");
+                exit(EXIT_FAILURE);
+            }
+            *written += pos - run;
+        }
+        if (pos < len) {
+            (*zero_pages)++;
+        }
+        run = pos + page_size;
+    }
+}
+
+void *copy_worker(void *arg)
+{
+    (void)arg;
+    char *buf = malloc(CHUNK_SIZE);
+    if (buf == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    unsigned long written = 0, zero_pages = 0, unreadable_pages = 0;
+    int region;
+    unsigned long addr, len;
+    while (next_chunk(&region, &addr, &len)) {
+        off_t offset = regions[region].offset + (addr - regions[region].start);
+        unsigned long done = 0;
+        while (done < len) {
+            struct iovec local = { buf, len - done };
+            struct iovec remote = { (void *)(addr + done), len - done };
+            ssize_t n = process_vm_readv(pid, &local, 1, &remote, 1, 0);
+            if (n <= 0) {
+                // Skip the page we couldn't read and leave a hole
+                unreadable_pages++;
+                done += page_size;
+                continue;
+            }
+            write_pages(buf, n, offset + done, &written, &zero_pages);
+            done += n;
+        }
+    }
+    free(buf);
+
+    pthread_mutex_lock(&work.lock);
+    work.written += written;
+    work.zero_pages += zero_pages;
+    work.unreadable_pages += unreadable_pages;
+    pthread_mutex_unlock(&work.lock);
+    return NULL;
+}
+
+void copy_regions(int nworkers, bool late)
+{
+    work.late = late;
+    work.region = 0;
+    work.addr = nregions > 0 ? regions[0].start : 0;
+
+    pthread_t workers[nworkers];
+    for (int i = 0; i < nworkers; i++) {
+        if (pthread_create(&workers[i], NULL, copy_worker, NULL) != 0) {
+            fprintf(stderr, "pthread_create failed\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int i = 0; i < nworkers; i++) {
+        pthread_join(workers[i], NULL);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int nworkers = 4;
+    bool split_late = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "j:l")) != -1) {
+        switch (opt) {
+        case 'j':
+            nworkers = atoi(optarg);
+            break;
+        case 'l':
+            split_late = true;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (argc - optind != 2 || nworkers <= 0) {
+        usage(argv[0]);
+    }
+
+    pid = atoi(argv[optind]);
+    if (pid <= 0) {
+        usage(argv[0]);
+    }
+
+    page_size = sysconf(_SC_PAGESIZE);
+    core_fd = open(argv[optind + 1], O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (core_fd == -1) {
+        perror(argv[optind + 1]);
+        exit(EXIT_FAILURE);
+    }
+
+    double t_start = now_ms();
+    stop_all_threads();
+    if (nthreads == 0) {
+        fprintf(stderr, "Could not attach to any thread of %d\n", pid);
+        exit(EXIT_FAILURE);
+    }
+    double t_stopped = now_ms();
+
+    read_maps(split_late);
+    off_t size = write_headers();
+    copy_regions(nworkers, false);
+
+    resume_all_threads();
+    double t_resumed = now_ms();
+
+    if (split_late) {
+        copy_regions(nworkers, true);
+    }
+
+    if (ftruncate(core_fd, size) == -1) {
+        perror("ftruncate");
+        exit(EXIT_FAILURE);
+    }
+    close(core_fd);
+    double t_done = now_ms();
+
+    printf("Dumped %d threads, %d mappings, %lu MiB (%lu MiB written, "
+           "%lu zero pages skipped, %lu unreadable)\n",
+           nthreads, nregions, (unsigned long)(size >> 20),
+           work.written >> 20, work.zero_pages, work.unreadable_pages);
+    printf("Stopped for %.1f ms (%.1f ms to stop all threads), "
+           "%.1f ms in total\n",
+           t_resumed - t_start, t_stopped - t_start, t_done - t_start);
+    return 0;
+}
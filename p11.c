@@ -0,0 +1,1160 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <errno.h>
+#include <sys/ptrace.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/user.h>
+#include <sys/reg.h>
+#include <sys/prctl.h>
+#include <sys/mman.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+#include <linux/audit.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <signal.h>
+
+/**
+ * Runs a program and prints the syscalls that match a filter
+ * expression, on x86_64. For example:
+ *
+ *   ./p11 'write && arg0 == 2 && arg2 > 4096' ./server
+ *   ./p11 'openat && (arg2 & O_CREAT)' ./server
+ *   ./p11 'openat && arg1 == "/etc/passwd"' ./server
+ *
+ * In p05.c to p09.c the tracee stops twice for every syscall and the
+ * tracer then decides whether it cares about it or not. That gets
+ * expensive when we only want a few of them. Here the expression is
+ * instead compiled to a classic BPF program which the child installs
+ * as a seccomp filter before it execs the program. The filter returns
+ * SECCOMP_RET_TRACE for syscalls that match, which gives us a
+ * PTRACE_EVENT_SECCOMP stop (with PTRACE_O_TRACESECCOMP), and
+ * SECCOMP_RET_ALLOW for everything else, in which case the tracee
+ * never stops at all. A seccomp filter can only be installed by the
+ * process itself, which is why this launches the program instead of
+ * attaching to it like p07.c does.
+ *
+ * The expression language has syscall names, arg0 to arg5, numbers,
+ * a few constants like O_CREAT, the comparisons == != < <= > >= (on
+ * unsigned 64-bit values), & for masking, and && || ! and
+ * parentheses. A value on its own means "is non-zero". Arguments of
+ * type int show up zero-extended, which is why AT_FDCWD is defined as
+ * 0xffffff9c rather than -100.
+ *
+ * The compiler first rewrites the expression so that ! only applies
+ * to syscall names, and then evaluates it once per syscall number.
+ * What is left is a predicate on the arguments only (or simply true
+ * or false). Syscalls that end up with the same predicate share the
+ * same code, and consecutive syscall numbers that share code are
+ * merged into ranges. The ranges are searched with a balanced tree of
+ * jge instructions, which is the closest thing to a jump table that
+ * classic BPF has. seccomp_data.args are 64-bit, but BPF only works on
+ * 32-bit words, so each comparison is split into a high and a low word
+ * comparison.
+ *
+ * String comparisons can't be done by the kernel since the filter
+ * can't follow pointers. They are treated as true in the filter, so
+ * that the filter lets through a superset of what we want, and the
+ * whole expression is evaluated again in the tracer when it gets the
+ * PTRACE_EVENT_SECCOMP stop.
+ *
+ * Children inherit the filter, and any syscall returning
+ * SECCOMP_RET_TRACE without a tracer fails with ENOSYS, so forked
+ * processes and threads must be traced as well.
+ *
+ * Pass -d to print the generated BPF program.
+ */
+
+char *syscalls[] =
+    {
+     "read", "write", "open", "close", "stat", "fstat", "lstat", "poll",
+     "lseek", "mmap", "mprotect", "munmap", "brk", "rt_sigaction",
+     "rt_sigprocmask", "rt_sigreturn", "ioctl", "pread64", "pwrite64", "readv",
+     "writev", "access", "pipe", "select", "sched_yield", "mremap", "msync",
+     "mincore", "madvise", "shmget", "shmat", "shmctl", "dup", "dup2", "pause",
+     "nanosleep", "getitimer", "alarm", "setitimer", "getpid", "sendfile",
+     "socket", "connect", "accept", "sendto", "recvfrom", "sendmsg", "recvmsg",
+     "shutdown", "bind", "listen", "getsockname", "getpeername", "socketpair",
+     "setsockopt", "getsockopt", "clone", "fork", "vfork", "execve", "exit",
+     "wait4", "kill", "uname", "semget", "semop", "semctl", "shmdt", "msgget",
+     "msgsnd", "msgrcv", "msgctl", "fcntl", "flock", "fsync", "fdatasync",
+     "truncate", "ftruncate", "getdents", "getcwd", "chdir", "fchdir", "rename",
+     "mkdir", "rmdir", "creat", "link", "unlink", "symlink", "readlink",
+     "chmod", "fchmod", "chown", "fchown", "lchown", "umask", "gettimeofday",
+     "getrlimit", "getrusage", "sysinfo", "times", "ptrace", "getuid", "syslog",
+     "getgid", "setuid", "setgid", "geteuid", "getegid", "setpgid", "getppid",
+     "getpgrp", "setsid", "setreuid", "setregid", "getgroups", "setgroups",
+     "setresuid", "getresuid", "setresgid", "getresgid", "getpgid", "setfsuid",
+     "setfsgid", "getsid", "capget", "capset", "rt_sigpending",
+     "rt_sigtimedwait", "rt_sigqueueinfo", "rt_sigsuspend", "sigaltstack",
+     "utime", "mknod", "uselib", "personality", "ustat", "statfs", "fstatfs",
+     "sysfs", "getpriority", "setpriority", "sched_setparam", "sched_getparam",
+     "sched_setscheduler", "sched_getscheduler", "sched_get_priority_max",
+     "sched_get_priority_min", "sched_rr_get_interval", "mlock", "munlock",
+     "mlockall", "munlockall", "vhangup", "modify_ldt", "pivot_root", "_sysctl",
+     "prctl", "arch_prctl", "adjtimex", "setrlimit", "chroot", "sync", "acct",
+     "settimeofday", "mount", "umount2", "swapon", "swapoff", "reboot",
+     "sethostname", "setdomainname", "iopl", "ioperm", "create_module",
+     "init_module", "delete_module", "get_kernel_syms", "query_module",
+     "quotactl", "nfsservctl", "getpmsg", "putpmsg", "afs_syscall", "tuxcall",
+     "security", "gettid", "readahead", "setxattr", "lsetxattr", "fsetxattr",
+     "getxattr", "lgetxattr", "fgetxattr", "listxattr", "llistxattr",
+     "flistxattr", "removexattr", "lremovexattr", "fremovexattr", "tkill",
+     "time", "futex", "sched_setaffinity", "sched_getaffinity",
+     "set_thread_area", "io_setup", "io_destroy", "io_getevents", "io_submit",
+     "io_cancel", "get_thread_area", "lookup_dcookie", "epoll_create",
+     "epoll_ctl_old", "epoll_wait_old", "remap_file_pages", "getdents64",
+     "set_tid_address", "restart_syscall", "semtimedop", "fadvise64",
+     "timer_create", "timer_settime", "timer_gettime", "timer_getoverrun",
+     "timer_delete", "clock_settime", "clock_gettime", "clock_getres",
+     "clock_nanosleep", "exit_group", "epoll_wait", "epoll_ctl", "tgkill",
+     "utimes", "vserver", "mbind", "set_mempolicy", "get_mempolicy", "mq_open",
+     "mq_unlink", "mq_timedsend", "mq_timedreceive", "mq_notify",
+     "mq_getsetattr", "kexec_load", "waitid", "add_key", "request_key",
+     "keyctl", "ioprio_set", "ioprio_get", "inotify_init", "inotify_add_watch",
+     "inotify_rm_watch", "migrate_pages", "openat", "mkdirat", "mknodat",
+     "fchownat", "futimesat", "newfstatat", "unlinkat", "renameat", "linkat",
+     "symlinkat", "readlinkat", "fchmodat", "faccessat", "pselect6", "ppoll",
+     "unshare", "set_robust_list", "get_robust_list", "splice", "tee",
+     "sync_file_range", "vmsplice", "move_pages", "utimensat", "epoll_pwait",
+     "signalfd", "timerfd_create", "eventfd", "fallocate", "timerfd_settime",
+     "timerfd_gettime", "accept4", "signalfd4", "eventfd2", "epoll_create1",
+     "dup3", "pipe2", "inotify_init1", "preadv", "pwritev", "rt_tgsigqueueinfo",
+     "perf_event_open", "recvmmsg", "fanotify_init", "fanotify_mark",
+     "prlimit64", "name_to_handle_at", "open_by_handle_at", "clock_adjtime",
+     "syncfs", "sendmmsg", "setns", "getcpu", "process_vm_readv",
+     "process_vm_writev", "kcmp", "finit_module", "sched_setattr",
+     "sched_getattr", "renameat2", "seccomp", "getrandom", "memfd_create",
+     "kexec_file_load", "bpf", "execveat", "userfaultfd", "membarrier",
+     "mlock2", "copy_file_range", "preadv2", "pwritev2", "pkey_mprotect",
+     "pkey_alloc", "pkey_free", "statx", "io_pgetevents", "rseq"
+    };
+
+#define NSYSCALLS ((int)(sizeof(syscalls) / sizeof(syscalls[0])))
+
+struct constant {
+    const char *name;
+    uint64_t value;
+} constants[] = {
+    { "O_RDONLY", O_RDONLY }, { "O_WRONLY", O_WRONLY }, { "O_RDWR", O_RDWR },
+    { "O_CREAT", O_CREAT }, { "O_EXCL", O_EXCL }, { "O_TRUNC", O_TRUNC },
+    { "O_APPEND", O_APPEND }, { "O_NONBLOCK", O_NONBLOCK },
+    { "O_DIRECTORY", O_DIRECTORY }, { "O_CLOEXEC", O_CLOEXEC },
+    { "AT_FDCWD", (uint32_t)AT_FDCWD },
+    { "PROT_READ", PROT_READ }, { "PROT_WRITE", PROT_WRITE },
+    { "PROT_EXEC", PROT_EXEC }, { "MAP_SHARED", MAP_SHARED },
+    { "MAP_PRIVATE", MAP_PRIVATE }, { "MAP_FIXED", MAP_FIXED },
+    { "MAP_ANONYMOUS", MAP_ANONYMOUS }, { "CLONE_THREAD", CLONE_THREAD },
+};
+
+enum kind { N_TRUE, N_FALSE, N_SYS, N_NOT, N_AND, N_OR, N_CMP, N_STR };
+enum op { OP_EQ, OP_NE, OP_LT, OP_LE, OP_GT, OP_GE };
+
+const char *op_names[] = { "==", "!=", "<", "<=", ">", ">=" };
+
+/* N_CMP is (arg & mask) op value, N_STR is string(arg) op str */
+struct node {
+    enum kind kind;
+    enum op op;
+    int nr;
+    int arg;
+    uint64_t mask;
+    uint64_t value;
+    char *str;
+    struct node *left;
+    struct node *right;
+};
+
+struct node *new_node(enum kind kind, struct node *left, struct node *right)
+{
+    struct node *n = calloc(1, sizeof(*n));
+    if (n == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    n->kind = kind;
+    n->left = left;
+    n->right = right;
+    return n;
+}
+
+/* Parser */
+
+const char *input;
+const char *pos;
+
+void parse_error(const char *msg)
+{
+    fprintf(stderr, "%s\n  %s\n  %*s^\n", msg, input, (int)(pos - input), "");
+    exit(EXIT_FAILURE);
+}
+
+void skip_space(void)
+{
+    while (isspace((unsigned char)*pos)) {
+        pos++;
+    }
+}
+
+bool accept(const char *token)
+{
+    skip_space();
+    size_t len = strlen(token);
+    if (strncmp(pos, token, len) == 0) {
+        pos += len;
+        return true;
+    }
+    return false;
+}
+
+bool peek_ident(char *ident, size_t size)
+{
+    skip_space();
+    size_t len = 0;
+    while (isalnum((unsigned char)pos[len]) || pos[len] == '_') {
+        len++;
+    }
+    if (len == 0 || len >= size || isdigit((unsigned char)pos[0])) {
+        return false;
+    }
+    memcpy(ident, pos, len);
+    ident[len] = '\0';
+    return true;
+}
+
+int find_syscall(const char *name)
+{
+    for (int i = 0; i < NSYSCALLS; i++) {
+        if (strcmp(syscalls[i], name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* A value is either an argument (arg >= 0) with a mask, or a constant */
+struct value {
+    int arg;
+    uint64_t mask;
+    uint64_t constant;
+    char *str;
+};
+
+struct value parse_value(void);
+
+struct value parse_term(void)
+{
+    struct value v = { -1, ~0ULL, 0, NULL };
+    char ident[64];
+    skip_space();
+    if (accept("(")) {
+        v = parse_value();
+        if (!accept(")")) {
+            parse_error("Expected )");
+        }
+    } else if (*pos == '"') {
+        const char *start = ++pos;
+        while (*pos && *pos != '"') {
+            pos++;
+        }
+        if (*pos != '"') {
+            parse_error("Unterminated string");
+        }
+        v.str = strndup(start, pos - start);
+        pos++;
+    } else if (isdigit((unsigned char)*pos) || *pos == '-') {
+        char *end;
+        errno = 0;
+        v.constant = *pos == '-' ? (uint64_t)strtoll(pos, &end, 0)
+                                 : strtoull(pos, &end, 0);
+        if (errno != 0 || end == pos) {
+            parse_error("Invalid number");
+        }
+        pos = end;
+    } else if (peek_ident(ident, sizeof(ident))) {
+        if (strncmp(ident, "arg", 3) == 0 && ident[3] >= '0' &&
+            ident[3] <= '5' && ident[4] == '\0') {
+            v.arg = ident[3] - '0';
+        } else {
+            size_t i;
+            for (i = 0; i < sizeof(constants) / sizeof(constants[0]); i++) {
+                if (strcmp(constants[i].name, ident) == 0) {
+                    v.constant = constants[i].value;
+                    break;
+                }
+            }
+            if (i == sizeof(constants) / sizeof(constants[0])) {
+                parse_error("Unknown name");
+            }
+        }
+        pos += strlen(ident);
+    } else {
+        parse_error("Expected a value");
+    }
+    return v;
+}
+
+struct value parse_term(void);
+
+/* A single &, as opposed to && */
+bool accept_mask(void)
+{
+    skip_space();
+    if (pos[0] == '&' && pos[1] != '&') {
+        pos++;
+        return true;
+    }
+    return false;
+}
+
+struct value parse_value(void)
+{
+    struct value v = parse_term();
+    while (accept_mask()) {
+        struct value w = parse_term();
+        if (v.str != NULL || w.str != NULL || (v.arg >= 0 && w.arg >= 0)) {
+            parse_error("Can only mask an argument with a constant");
+        }
+        if (v.arg >= 0) {
+            v.mask &= w.constant;
+        } else if (w.arg >= 0) {
+            w.mask &= v.constant;
+            v = w;
+        } else {
+            v.constant &= w.constant;
+        }
+    }
+    return v;
+}
+
+bool parse_op(enum op *op)
+{
+    // Longer operators first so that "<=" isn't read as "<"
+    static const enum op order[] = { OP_EQ, OP_NE, OP_LE, OP_GE, OP_LT, OP_GT };
+    for (size_t i = 0; i < sizeof(order) / sizeof(order[0]); i++) {
+        if (accept(op_names[order[i]])) {
+            *op = order[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+enum op swap_op(enum op op)
+{
+    switch (op) {
+    case OP_LT: return OP_GT;
+    case OP_LE: return OP_GE;
+    case OP_GT: return OP_LT;
+    case OP_GE: return OP_LE;
+    default: return op;
+    }
+}
+
+bool compare(uint64_t a, enum op op, uint64_t b)
+{
+    switch (op) {
+    case OP_EQ: return a == b;
+    case OP_NE: return a != b;
+    case OP_LT: return a < b;
+    case OP_LE: return a <= b;
+    case OP_GT: return a > b;
+    case OP_GE: return a >= b;
+    }
+    return false;
+}
+
+struct node *parse_or(void);
+
+struct node *parse_comparison(void)
+{
+    struct value a = parse_value();
+    enum op op = OP_NE;
+    struct value b = { -1, ~0ULL, 0, NULL };
+    if (!parse_op(&op)) {
+        if (a.str != NULL) {
+            parse_error("A string must be compared with an argument");
+        }
+    } else {
+        b = parse_value();
+    }
+
+    if (a.arg < 0 && b.arg >= 0) {
+        struct value tmp = a;
+        a = b;
+        b = tmp;
+        op = swap_op(op);
+    }
+
+    if (a.arg < 0) {
+        if (a.str != NULL || b.str != NULL) {
+            parse_error("A string must be compared with an argument");
+        }
+        return new_node(compare(a.constant, op, b.constant) ? N_TRUE : N_FALSE,
+                        NULL, NULL);
+    }
+    if (b.arg >= 0) {
+        parse_error("Can't compare two arguments");
+    }
+
+    struct node *n;
+    if (b.str != NULL) {
+        if ((op != OP_EQ && op != OP_NE) || a.mask != ~0ULL) {
+            parse_error("Strings can only be compared with == or !=");
+        }
+        n = new_node(N_STR, NULL, NULL);
+        n->str = b.str;
+    } else {
+        n = new_node(N_CMP, NULL, NULL);
+        n->mask = a.mask;
+        n->value = b.constant;
+    }
+    n->op = op;
+    n->arg = a.arg;
+    return n;
+}
+
+/*
+ * Called after a "(": tells if it starts a value as in
+ * "(arg2 & 0xff) == 2" rather than a group as in "(read || write)".
+ */
+bool value_in_parens(void)
+{
+    const char *saved = pos;
+    int depth = 1;
+    while (*pos && depth > 0) {
+        depth += *pos == '(' ? 1 : *pos == ')' ? -1 : 0;
+        pos++;
+    }
+    enum op op;
+    bool found = depth == 0 && parse_op(&op);
+    pos = saved;
+    return found;
+}
+
+struct node *parse_unary(void)
+{
+    if (accept("!")) {
+        return new_node(N_NOT, parse_unary(), NULL);
+    }
+    if (accept("(")) {
+        if (!value_in_parens()) {
+            struct node *n = parse_or();
+            if (!accept(")")) {
+                parse_error("Expected )");
+            }
+            return n;
+        }
+        pos--;
+    }
+
+    char ident[64];
+    if (peek_ident(ident, sizeof(ident))) {
+        int nr = find_syscall(ident);
+        if (nr >= 0) {
+            pos += strlen(ident);
+            struct node *n = new_node(N_SYS, NULL, NULL);
+            n->nr = nr;
+            return n;
+        }
+    }
+    return parse_comparison();
+}
+
+struct node *parse_and(void)
+{
+    struct node *n = parse_unary();
+    while (accept("&&")) {
+        n = new_node(N_AND, n, parse_unary());
+    }
+    return n;
+}
+
+struct node *parse_or(void)
+{
+    struct node *n = parse_and();
+    while (accept("||")) {
+        n = new_node(N_OR, n, parse_and());
+    }
+    return n;
+}
+
+struct node *parse(const char *expr)
+{
+    input = pos = expr;
+    struct node *n = parse_or();
+    skip_space();
+    if (*pos != '\0') {
+        parse_error("Unexpected input");
+    }
+    return n;
+}
+
+/* Transformations */
+
+enum op negate_op(enum op op)
+{
+    switch (op) {
+    case OP_EQ: return OP_NE;
+    case OP_NE: return OP_EQ;
+    case OP_LT: return OP_GE;
+    case OP_LE: return OP_GT;
+    case OP_GT: return OP_LE;
+    case OP_GE: return OP_LT;
+    }
+    return op;
+}
+
+/* Pushes negations down so that only N_SYS can be negated */
+struct node *push_not(struct node *n, bool negate)
+{
+    struct node *m;
+    switch (n->kind) {
+    case N_TRUE:
+    case N_FALSE:
+        return new_node((n->kind == N_TRUE) != negate ? N_TRUE : N_FALSE,
+                        NULL, NULL);
+    case N_SYS:
+        return negate ? new_node(N_NOT, n, NULL) : n;
+    case N_NOT:
+        return push_not(n->left, !negate);
+    case N_AND:
+    case N_OR:
+        return new_node((n->kind == N_AND) != negate ? N_AND : N_OR,
+                        push_not(n->left, negate), push_not(n->right, negate));
+    case N_CMP:
+    case N_STR:
+        m = new_node(n->kind, NULL, NULL);
+        *m = *n;
+        m->op = negate ? negate_op(n->op) : n->op;
+        return m;
+    }
+    return n;
+}
+
+struct node *true_node = &(struct node){ .kind = N_TRUE };
+struct node *false_node = &(struct node){ .kind = N_FALSE };
+
+/*
+ * What is left of the expression (after push_not) when the syscall
+ * number is nr, and the strings can't be checked. nr is -1 for numbers
+ * that don't have a name.
+ */
+struct node *residual(struct node *n, int nr)
+{
+    struct node *l, *r;
+    switch (n->kind) {
+    case N_SYS:
+        return n->nr == nr ? true_node : false_node;
+    case N_NOT:
+        return residual(n->left, nr) == true_node ? false_node : true_node;
+    case N_STR:
+        return true_node;
+    case N_AND:
+        l = residual(n->left, nr);
+        if (l == false_node) {
+            return false_node;
+        }
+        r = residual(n->right, nr);
+        if (l == true_node || r == false_node) {
+            return r;
+        }
+        return r == true_node ? l : new_node(N_AND, l, r);
+    case N_OR:
+        l = residual(n->left, nr);
+        if (l == true_node) {
+            return true_node;
+        }
+        r = residual(n->right, nr);
+        if (l == false_node || r == true_node) {
+            return r;
+        }
+        return r == false_node ? l : new_node(N_OR, l, r);
+    case N_TRUE:
+        return true_node;
+    case N_FALSE:
+        return false_node;
+    case N_CMP:
+        if (n->mask == 0) {
+            return compare(0, n->op, n->value) ? true_node : false_node;
+        }
+        return n;
+    }
+    return n;
+}
+
+void print_node(FILE *out, struct node *n)
+{
+    switch (n->kind) {
+    case N_TRUE: fprintf(out, "true"); break;
+    case N_FALSE: fprintf(out, "false"); break;
+    case N_SYS: fprintf(out, "%s", syscalls[n->nr]); break;
+    case N_NOT: fprintf(out, "!"); print_node(out, n->left); break;
+    case N_AND:
+    case N_OR:
+        fprintf(out, "(");
+        print_node(out, n->left);
+        fprintf(out, n->kind == N_AND ? " && " : " || ");
+        print_node(out, n->right);
+        fprintf(out, ")");
+        break;
+    case N_CMP:
+        if (n->mask != ~0ULL) {
+            fprintf(out, "(arg%d & %#llx) %s %#llx", n->arg,
+                    (unsigned long long)n->mask, op_names[n->op],
+                    (unsigned long long)n->value);
+        } else {
+            fprintf(out, "arg%d %s %#llx", n->arg, op_names[n->op],
+                    (unsigned long long)n->value);
+        }
+        break;
+    case N_STR:
+        fprintf(out, "arg%d %s \"%s\"", n->arg, op_names[n->op], n->str);
+        break;
+    }
+}
+
+char *node_key(struct node *n)
+{
+    char *buf;
+    size_t size;
+    FILE *out = open_memstream(&buf, &size);
+    print_node(out, n);
+    fclose(out);
+    return buf;
+}
+
+bool has_strings(struct node *n)
+{
+    if (n == NULL) {
+        return false;
+    }
+    return n->kind == N_STR || has_strings(n->left) || has_strings(n->right);
+}
+
+/* BPF code generation */
+
+#define MAX_LABELS 4096
+#define NEXT -1
+
+struct sock_filter prog[BPF_MAXINSNS];
+int jt_label[BPF_MAXINSNS];
+int jf_label[BPF_MAXINSNS];
+int ninsns;
+
+int label_pos[MAX_LABELS];
+int nlabels;
+
+/* Offset in seccomp_data currently held in the accumulator, or -1 */
+int acc = -1;
+
+void emit(uint16_t code, uint32_t k, int jt, int jf)
+{
+    if (ninsns == BPF_MAXINSNS) {
+        fprintf(stderr, "Filter is too large\n");
+        exit(EXIT_FAILURE);
+    }
+    prog[ninsns] = (struct sock_filter)BPF_JUMP(code, k, 0, 0);
+    jt_label[ninsns] = jt;
+    jf_label[ninsns] = jf;
+    ninsns++;
+}
+
+int new_label(void)
+{
+    if (nlabels == MAX_LABELS) {
+        fprintf(stderr, "Filter is too large\n");
+        exit(EXIT_FAILURE);
+    }
+    label_pos[nlabels] = -1;
+    return nlabels++;
+}
+
+void bind(int label)
+{
+    // Drop a jump to the instruction right after it
+    while (ninsns > 0 && prog[ninsns - 1].code == (BPF_JMP | BPF_JA) &&
+           jt_label[ninsns - 1] == label) {
+        ninsns--;
+        for (int i = 0; i < nlabels; i++) {
+            if (label_pos[i] == ninsns + 1) {
+                label_pos[i] = ninsns;
+            }
+        }
+    }
+    label_pos[label] = ninsns;
+    acc = -1;
+}
+
+void emit_load(int offset)
+{
+    if (acc != offset) {
+        emit(BPF_LD | BPF_W | BPF_ABS, offset, NEXT, NEXT);
+        acc = offset;
+    }
+}
+
+void emit_ja(int label)
+{
+    emit(BPF_JMP | BPF_JA, 0, label, NEXT);
+}
+
+void emit_ret(uint32_t value)
+{
+    emit(BPF_RET | BPF_K, value, NEXT, NEXT);
+    acc = -1;
+}
+
+/* Compares the masked 32-bit word at offset with value */
+void emit_word_jump(int offset, uint32_t mask, uint16_t jmp, uint32_t value,
+                    int jt, int jf)
+{
+    emit_load(offset);
+    if (mask != 0xffffffff) {
+        emit(BPF_ALU | BPF_AND | BPF_K, mask, NEXT, NEXT);
+        acc = -1;
+    }
+    emit(BPF_JMP | jmp | BPF_K, value, jt, jf);
+}
+
+void gen_cmp(struct node *n, int t, int f)
+{
+    int lo = offsetof(struct seccomp_data, args) + 8 * n->arg;
+    int hi = lo + 4;
+    uint32_t mask_lo = n->mask, mask_hi = n->mask >> 32;
+    uint32_t value_lo = n->value, value_hi = n->value >> 32;
+    switch (n->op) {
+    case OP_EQ:
+    case OP_NE:
+        if (n->op == OP_NE) {
+            int tmp = t;
+            t = f;
+            f = tmp;
+        }
+        if (mask_hi == 0 && value_hi != 0) {
+            emit_ja(f);
+            break;
+        }
+        if (mask_hi != 0) {
+            emit_word_jump(hi, mask_hi, BPF_JEQ, value_hi, NEXT, f);
+        }
+        emit_word_jump(lo, mask_lo, BPF_JEQ, value_lo, t, f);
+        break;
+    case OP_GT:
+    case OP_GE:
+    case OP_LT:
+    case OP_LE:
+        // a < b is !(a >= b) and a <= b is !(a > b)
+        if (n->op == OP_LT || n->op == OP_LE) {
+            int tmp = t;
+            t = f;
+            f = tmp;
+        }
+        if (mask_hi != 0) {
+            emit_word_jump(hi, mask_hi, BPF_JGT, value_hi, t, NEXT);
+            emit_word_jump(hi, mask_hi, BPF_JEQ, value_hi, NEXT, f);
+        } else if (value_hi != 0) {
+            emit_ja(f);
+            break;
+        }
+        emit_word_jump(lo, mask_lo,
+                       n->op == OP_GT || n->op == OP_LE ? BPF_JGT : BPF_JGE,
+                       value_lo, t, f);
+        break;
+    }
+}
+
+void gen(struct node *n, int t, int f)
+{
+    int next;
+    switch (n->kind) {
+    case N_TRUE:
+        emit_ja(t);
+        break;
+    case N_FALSE:
+        emit_ja(f);
+        break;
+    case N_AND:
+        next = new_label();
+        gen(n->left, next, f);
+        bind(next);
+        gen(n->right, t, f);
+        break;
+    case N_OR:
+        next = new_label();
+        gen(n->left, t, next);
+        bind(next);
+        gen(n->right, t, f);
+        break;
+    case N_CMP:
+        gen_cmp(n, t, f);
+        break;
+    default:
+        // Syscalls, negations and strings are gone after residual()
+        abort();
+    }
+}
+
+struct range {
+    uint32_t start;
+    int block;
+};
+
+struct block {
+    struct node *residual;
+    char *key;
+    int label;
+};
+
+/* Block 0 always allows and block 1 always traces */
+struct block blocks[NSYSCALLS + 3];
+int nblocks;
+
+struct range ranges[NSYSCALLS + 1];
+int nranges;
+
+int find_block(struct node *residual)
+{
+    if (residual == false_node) {
+        return 0;
+    } else if (residual == true_node) {
+        return 1;
+    }
+    char *key = node_key(residual);
+    for (int i = 2; i < nblocks; i++) {
+        if (strcmp(blocks[i].key, key) == 0) {
+            free(key);
+            return i;
+        }
+    }
+    blocks[nblocks].residual = residual;
+    blocks[nblocks].key = key;
+    blocks[nblocks].label = new_label();
+    return nblocks++;
+}
+
+void gen_ranges(int lo, int hi)
+{
+    if (lo == hi) {
+        int block = ranges[lo].block;
+        if (block < 2) {
+            emit_ret(block == 0 ? SECCOMP_RET_ALLOW : SECCOMP_RET_TRACE);
+        } else {
+            emit_ja(blocks[block].label);
+        }
+        return;
+    }
+    int mid = (lo + hi + 1) / 2;
+    int right = new_label();
+    emit(BPF_JMP | BPF_JGE | BPF_K, ranges[mid].start, right, NEXT);
+    gen_ranges(lo, mid - 1);
+    bind(right);
+    // Still holds the syscall number, since only jumps lead here
+    acc = offsetof(struct seccomp_data, nr);
+    gen_ranges(mid, hi);
+}
+
+void compile(struct node *expr)
+{
+    nblocks = 2;
+    for (int nr = 0; nr <= NSYSCALLS; nr++) {
+        // The last range covers all numbers we have no name for
+        int block = find_block(residual(expr, nr < NSYSCALLS ? nr : -1));
+        if (nranges == 0 || ranges[nranges - 1].block != block) {
+            ranges[nranges].start = nr;
+            ranges[nranges].block = block;
+            nranges++;
+        }
+    }
+
+    int arch_ok = new_label();
+    emit_load(offsetof(struct seccomp_data, arch));
+    emit(BPF_JMP | BPF_JEQ | BPF_K, AUDIT_ARCH_X86_64, arch_ok, NEXT);
+    emit_ret(SECCOMP_RET_ALLOW);
+    bind(arch_ok);
+    emit_load(offsetof(struct seccomp_data, nr));
+    gen_ranges(0, nranges - 1);
+
+    for (int i = 2; i < nblocks; i++) {
+        int trace = new_label(), allow = new_label();
+        bind(blocks[i].label);
+        gen(blocks[i].residual, trace, allow);
+        bind(allow);
+        emit_ret(SECCOMP_RET_ALLOW);
+        bind(trace);
+        emit_ret(SECCOMP_RET_TRACE);
+    }
+
+    for (int i = 0; i < ninsns; i++) {
+        struct sock_filter *insn = &prog[i];
+        if (insn->code == (BPF_JMP | BPF_JA)) {
+            insn->k = label_pos[jt_label[i]] - (i + 1);
+        } else if (BPF_CLASS(insn->code) == BPF_JMP) {
+            int jt = jt_label[i] == NEXT ? 0 : label_pos[jt_label[i]] - (i + 1);
+            int jf = jf_label[i] == NEXT ? 0 : label_pos[jf_label[i]] - (i + 1);
+            if (jt > 255 || jf > 255) {
+                fprintf(stderr, "Filter is too complex, jump is too long\n");
+                exit(EXIT_FAILURE);
+            }
+            insn->jt = jt;
+            insn->jf = jf;
+        }
+    }
+}
+
+void dump_program(void)
+{
+    printf("%d ranges, %d blocks, %d instructions\n",
+           nranges, nblocks - 2, ninsns);
+    for (int i = 2; i < nblocks; i++) {
+        printf("block %d: %s\n", i, blocks[i].key);
+    }
+    for (int i = 0; i < ninsns; i++) {
+        struct sock_filter *insn = &prog[i];
+        printf("(%03d) ", i);
+        switch (BPF_CLASS(insn->code)) {
+        case BPF_LD:
+            printf("ld   [%u]\n", insn->k);
+            break;
+        case BPF_ALU:
+            printf("and  #%#x\n", insn->k);
+            break;
+        case BPF_RET:
+            printf("ret  #%s\n", insn->k == SECCOMP_RET_ALLOW ? "allow" : "trace");
+            break;
+        case BPF_JMP:
+            if (insn->code == (BPF_JMP | BPF_JA)) {
+                printf("ja   %d\n", i + 1 + insn->k);
+                break;
+            }
+            printf("%s #%#x jt %d jf %d\n",
+                   BPF_OP(insn->code) == BPF_JEQ ? "jeq " :
+                   BPF_OP(insn->code) == BPF_JGT ? "jgt " : "jge ",
+                   insn->k, i + 1 + insn->jt, i + 1 + insn->jf);
+            break;
+        }
+    }
+}
+
+/* Tracer side */
+
+bool read_string(pid_t pid, unsigned long addr, char *buf, size_t size)
+{
+    for (size_t i = 0; i < size; i += sizeof(long)) {
+        errno = 0;
+        long word = ptrace(PTRACE_PEEKDATA, pid, addr + i, 0);
+        if (errno != 0) {
+            return false;
+        }
+        size_t n = size - i < sizeof(long) ? size - i : sizeof(long);
+        memcpy(buf + i, &word, n);
+        if (memchr(&word, '\0', n) != NULL) {
+            return true;
+        }
+    }
+    buf[size - 1] = '\0';
+    return true;
+}
+
+bool eval(struct node *n, pid_t pid, long nr, const uint64_t args[6])
+{
+    char buf[4096];
+    switch (n->kind) {
+    case N_TRUE: return true;
+    case N_FALSE: return false;
+    case N_SYS: return n->nr == nr;
+    case N_NOT: return !eval(n->left, pid, nr, args);
+    case N_AND:
+        return eval(n->left, pid, nr, args) && eval(n->right, pid, nr, args);
+    case N_OR:
+        return eval(n->left, pid, nr, args) || eval(n->right, pid, nr, args);
+    case N_CMP:
+        return compare(args[n->arg] & n->mask, n->op, n->value);
+    case N_STR:
+        if (!read_string(pid, args[n->arg], buf, sizeof(buf))) {
+            return false;
+        }
+        return (strcmp(buf, n->str) == 0) == (n->op == OP_EQ);
+    }
+    return false;
+}
+
+#define MAX_TASKS 1024
+
+struct task {
+    pid_t tid;
+    bool insyscall;
+    long nr;
+    uint64_t args[6];
+} tasks[MAX_TASKS];
+int ntasks;
+
+struct task *find_task(pid_t tid, bool create)
+{
+    for (int i = 0; i < ntasks; i++) {
+        if (tasks[i].tid == tid) {
+            return &tasks[i];
+        }
+    }
+    if (!create || ntasks == MAX_TASKS) {
+        return NULL;
+    }
+    memset(&tasks[ntasks], 0, sizeof(tasks[ntasks]));
+    tasks[ntasks].tid = tid;
+    return &tasks[ntasks++];
+}
+
+void print_call(struct task *task)
+{
+    const char *name = task->nr >= 0 && task->nr < NSYSCALLS ?
+        syscalls[task->nr] : "?";
+    fprintf(stderr, "[%d] %s(%#llx, %#llx, %#llx, %#llx, %#llx, %#llx)",
+            task->tid, name,
+            (unsigned long long)task->args[0], (unsigned long long)task->args[1],
+            (unsigned long long)task->args[2], (unsigned long long)task->args[3],
+            (unsigned long long)task->args[4], (unsigned long long)task->args[5]);
+}
+
+void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-d] <expression> <program> [args...]\n", name);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+    bool dump = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "+d")) != -1) {
+        if (opt == 'd') {
+            dump = true;
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (argc - optind < 1 || (!dump && argc - optind < 2)) {
+        usage(argv[0]);
+    }
+
+    struct node *expr = push_not(parse(argv[optind]), false);
+    bool in_tracer = has_strings(expr);
+    compile(expr);
+    if (dump) {
+        dump_program();
+    }
+    if (argc - optind < 2) {
+        return 0;
+    }
+
+    pid_t child = fork();
+    if (child == 0) {
+        struct sock_fprog fprog = { ninsns, prog };
+        ptrace(PTRACE_TRACEME, 0, 0, 0);
+        raise(SIGSTOP);
+        if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) == -1 ||
+            prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &fprog) == -1) {
+            perror("prctl");
+            exit(EXIT_FAILURE);
+        }
+        execvp(argv[optind + 1], argv + optind + 1);
+        perror(argv[optind + 1]);
+        exit(EXIT_FAILURE);
+    }
+
+    int status;
+    if (waitpid(child, &status, __WALL) == -1) {
+        perror("waitpid");
+        exit(EXIT_FAILURE);
+    }
+    long options = PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACESECCOMP |
+        PTRACE_O_EXITKILL | PTRACE_O_TRACEEXEC | PTRACE_O_TRACEFORK |
+        PTRACE_O_TRACEVFORK | PTRACE_O_TRACECLONE;
+    if (ptrace(PTRACE_SETOPTIONS, child, 0, options) == -1) {
+        perror("PTRACE_SETOPTIONS");
+        exit(EXIT_FAILURE);
+    }
+    find_task(child, true);
+    ptrace(PTRACE_CONT, child, 0, 0);
+
+    unsigned long matched = 0, rejected = 0;
+    int exit_status = 0;
+    pid_t tid;
+    while ((tid = waitpid(-1, &status, __WALL)) != -1) {
+        // New tasks are added before their first stop is handled
+        bool is_new = find_task(tid, false) == NULL;
+        struct task *task = find_task(tid, true);
+
+        if (WIFEXITED(status) || WIFSIGNALED(status)) {
+            if (task != NULL && task->insyscall) {
+                print_call(task);
+                fprintf(stderr, " = ?\n");
+            }
+            if (task != NULL) {
+                *task = tasks[--ntasks];
+            }
+            if (tid == child) {
+                exit_status = WIFEXITED(status) ? WEXITSTATUS(status)
+                                                : 128 + WTERMSIG(status);
+            }
+            continue;
+        }
+
+        int sig = WSTOPSIG(status);
+        int event = status >> 16;
+        int inject = 0;
+        enum __ptrace_request resume = PTRACE_CONT;
+
+        if (event == PTRACE_EVENT_SECCOMP && task != NULL) {
+            struct user_regs_struct regs;
+            ptrace(PTRACE_GETREGS, tid, 0, &regs);
+            task->nr = regs.orig_rax;
+            task->args[0] = regs.rdi;
+            task->args[1] = regs.rsi;
+            task->args[2] = regs.rdx;
+            task->args[3] = regs.r10;
+            task->args[4] = regs.r8;
+            task->args[5] = regs.r9;
+            if (in_tracer && !eval(expr, tid, task->nr, task->args)) {
+                rejected++;
+            } else {
+                // Stop once more at syscall-exit to get the result
+                matched++;
+                task->insyscall = true;
+                resume = PTRACE_SYSCALL;
+            }
+        } else if (sig == (SIGTRAP | 0x80) && task != NULL) {
+            if (task->insyscall) {
+                print_call(task);
+                fprintf(stderr, " = %lld\n",
+                        (long long)ptrace(PTRACE_PEEKUSER, tid, 8 * RAX, 0));
+                task->insyscall = false;
+            }
+        } else if (event != 0 || (sig == SIGSTOP && is_new)) {
+            // Fork, clone and exec events, and the initial stop of new
+            // tasks, are not signals to the tracee
+        } else {
+            inject = sig;
+        }
+        if (task != NULL && task->insyscall) {
+            // Exec, fork and clone events, and signals, can arrive
+            // between the seccomp stop and the syscall-exit
+            resume = PTRACE_SYSCALL;
+        }
+        ptrace(resume, tid, 0, inject);
+    }
+
+    fprintf(stderr, "%lu syscalls matched", matched);
+    if (in_tracer) {
+        fprintf(stderr, ", %lu more rejected by the tracer", rejected);
+    }
+    fprintf(stderr, "\n");
+    return exit_status;
+}
@@ -0,0 +1,565 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <sys/ptrace.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <signal.h>
+#include <time.h>
+
+/**
+ * A tracer daemon which is reconfigured at runtime, on x86_64.
+ *
+ * p07.c to p09.c spend all their time blocked in waitpid, so the only
+ * way to change what they do is to restart them, which means
+ * detaching from and reattaching to the tracee. Here the main loop is
+ * an epoll loop instead, and the tracer learns about ptrace-stops from
+ * a signalfd for SIGCHLD. The tracer gets a SIGCHLD for every
+ * ptrace-stop and exit of a tracee even though the tracee isn't its
+ * child. Several SIGCHLDs may be merged into one, so every time the
+ * signalfd is readable we call waitpid with WNOHANG until there is
+ * nothing more to reap.
+ *
+ * I first looked at pidfd_open, but a pidfd only becomes readable when
+ * the process exits, not when it enters a ptrace-stop, so it doesn't
+ * help here.
+ *
+ * The daemon listens on a Unix domain socket for line-based commands,
+ * which can be sent with for example `socat - UNIX-CONNECT:<path>`:
+ *
+ *   trace on|off        stop at syscalls or let the tracees run freely
+ *   mode full|summary   print every syscall or only count them
+ *   stats               syscall counts and time per tracee
+ *   reset               clear the counts
+ *   attach <pid>        start tracing another process
+ *   detach <pid>        stop tracing a process
+ *   list                list the tracees
+ *   quit                detach from everything and exit
+ *
+ * When tracing is off the tracees are resumed with PTRACE_CONT rather
+ * than PTRACE_SYSCALL, so they don't stop at all, but they stay
+ * attached. To turn tracing back on, or to detach, we need the tracee
+ * to stop first, which is done with PTRACE_INTERRUPT. The new setting
+ * is applied when the PTRACE_EVENT_STOP arrives.
+ *
+ * Since tracing can be turned on and off in the middle of a syscall,
+ * keeping track of entry and exit with a flag, as in p05.c, isn't
+ * reliable anymore. PTRACE_GET_SYSCALL_INFO tells which one it is.
+ *
+ * As in p09.c, only the given thread of each process is traced,
+ * signals are delivered to the tracee and group-stops are handled
+ * with PTRACE_LISTEN.
+ */
+
+char *syscalls[] =
+    {
+     "read", "write", "open", "close", "stat", "fstat", "lstat", "poll",
+     "lseek", "mmap", "mprotect", "munmap", "brk", "rt_sigaction",
+     "rt_sigprocmask", "rt_sigreturn", "ioctl", "pread64", "pwrite64", "readv",
+     "writev", "access", "pipe", "select", "sched_yield", "mremap", "msync",
+     "mincore", "madvise", "shmget", "shmat", "shmctl", "dup", "dup2", "pause",
+     "nanosleep", "getitimer", "alarm", "setitimer", "getpid", "sendfile",
+     "socket", "connect", "accept", "sendto", "recvfrom", "sendmsg", "recvmsg",
+     "shutdown", "bind", "listen", "getsockname", "getpeername", "socketpair",
+     "setsockopt", "getsockopt", "clone", "fork", "vfork", "execve", "exit",
+     "wait4", "kill", "uname", "semget", "semop", "semctl", "shmdt", "msgget",
+     "msgsnd", "msgrcv", "msgctl", "fcntl", "flock", "fsync", "fdatasync",
+     "truncate", "ftruncate", "getdents", "getcwd", "chdir", "fchdir", "rename",
+     "mkdir", "rmdir", "creat", "link", "unlink", "symlink", "readlink",
+     "chmod", "fchmod", "chown", "fchown", "lchown", "umask", "gettimeofday",
+     "getrlimit", "getrusage", "sysinfo", "times", "ptrace", "getuid", "syslog",
+     "getgid", "setuid", "setgid", "geteuid", "getegid", "setpgid", "getppid",
+     "getpgrp", "setsid", "setreuid", "setregid", "getgroups", "setgroups",
+     "setresuid", "getresuid", "setresgid", "getresgid", "getpgid", "setfsuid",
+     "setfsgid", "getsid", "capget", "capset", "rt_sigpending",
+     "rt_sigtimedwait", "rt_sigqueueinfo", "rt_sigsuspend", "sigaltstack",
+     "utime", "mknod", "uselib", "personality", "ustat", "statfs", "fstatfs",
+     "sysfs", "getpriority", "setpriority", "sched_setparam", "sched_getparam",
+     "sched_setscheduler", "sched_getscheduler", "sched_get_priority_max",
+     "sched_get_priority_min", "sched_rr_get_interval", "mlock", "munlock",
+     "mlockall", "munlockall", "vhangup", "modify_ldt", "pivot_root", "_sysctl",
+     "prctl", "arch_prctl", "adjtimex", "setrlimit", "chroot", "sync", "acct",
+     "settimeofday", "mount", "umount2", "swapon", "swapoff", "reboot",
+     "sethostname", "setdomainname", "iopl", "ioperm", "create_module",
+     "init_module", "delete_module", "get_kernel_syms", "query_module",
+     "quotactl", "nfsservctl", "getpmsg", "putpmsg", "afs_syscall", "tuxcall",
+     "security", "gettid", "readahead", "setxattr", "lsetxattr", "fsetxattr",
+     "getxattr", "lgetxattr", "fgetxattr", "listxattr", "llistxattr",
+     "flistxattr", "removexattr", "lremovexattr", "fremovexattr", "tkill",
+     "time", "futex", "sched_setaffinity", "sched_getaffinity",
+     "set_thread_area", "io_setup", "io_destroy", "io_getevents", "io_submit",
+     "io_cancel", "get_thread_area", "lookup_dcookie", "epoll_create",
+     "epoll_ctl_old", "epoll_wait_old", "remap_file_pages", "getdents64",
+     "set_tid_address", "restart_syscall", "semtimedop", "fadvise64",
+     "timer_create", "timer_settime", "timer_gettime", "timer_getoverrun",
+     "timer_delete", "clock_settime", "clock_gettime", "clock_getres",
+     "clock_nanosleep", "exit_group", "epoll_wait", "epoll_ctl", "tgkill",
+     "utimes", "vserver", "mbind", "set_mempolicy", "get_mempolicy", "mq_open",
+     "mq_unlink", "mq_timedsend", "mq_timedreceive", "mq_notify",
+     "mq_getsetattr", "kexec_load", "waitid", "add_key", "request_key",
+     "keyctl", "ioprio_set", "ioprio_get", "inotify_init", "inotify_add_watch",
+     "inotify_rm_watch", "migrate_pages", "openat", "mkdirat", "mknodat",
+     "fchownat", "futimesat", "newfstatat", "unlinkat", "renameat", "linkat",
+     "symlinkat", "readlinkat", "fchmodat", "faccessat", "pselect6", "ppoll",
+     "unshare", "set_robust_list", "get_robust_list", "splice", "tee",
+     "sync_file_range", "vmsplice", "move_pages", "utimensat", "epoll_pwait",
+     "signalfd", "timerfd_create", "eventfd", "fallocate", "timerfd_settime",
+     "timerfd_gettime", "accept4", "signalfd4", "eventfd2", "epoll_create1",
+     "dup3", "pipe2", "inotify_init1", "preadv", "pwritev", "rt_tgsigqueueinfo",
+     "perf_event_open", "recvmmsg", "fanotify_init", "fanotify_mark",
+     "prlimit64", "name_to_handle_at", "open_by_handle_at", "clock_adjtime",
+     "syncfs", "sendmmsg", "setns", "getcpu", "process_vm_readv",
+     "process_vm_writev", "kcmp", "finit_module", "sched_setattr",
+     "sched_getattr", "renameat2", "seccomp", "getrandom", "memfd_create",
+     "kexec_file_load", "bpf", "execveat", "userfaultfd", "membarrier",
+     "mlock2", "copy_file_range", "preadv2", "pwritev2", "pkey_mprotect",
+     "pkey_alloc", "pkey_free", "statx", "io_pgetevents", "rseq"
+    };
+
+#define NSYSCALLS ((int)(sizeof(syscalls) / sizeof(syscalls[0])))
+#define MAX_TRACEES 64
+#define MAX_CLIENTS 16
+#define MAX_EVENTS 16
+
+struct tracee {
+    pid_t pid;
+    bool detaching;
+    long nr;
+    double entry_time;
+    unsigned long total;
+    unsigned long counts[NSYSCALLS];
+    double time[NSYSCALLS];
+};
+
+struct client {
+    int fd;
+    size_t len;
+    char buf[256];
+};
+
+struct tracee tracees[MAX_TRACEES];
+int ntracees;
+
+struct client clients[MAX_CLIENTS];
+int nclients;
+
+bool tracing = true;
+bool full_output = true;
+bool quitting = false;
+
+int epfd;
+
+double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+struct tracee *find_tracee(pid_t pid)
+{
+    for (int i = 0; i < ntracees; i++) {
+        if (tracees[i].pid == pid) {
+            return &tracees[i];
+        }
+    }
+    return NULL;
+}
+
+void remove_tracee(struct tracee *t)
+{
+    *t = tracees[--ntracees];
+}
+
+void reply(struct client *c, const char *fmt, ...)
+{
+    char buf[512];
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    if (len >= (int)sizeof(buf)) {
+        len = sizeof(buf) - 1;
+    }
+    // A client that doesn't read its replies only loses them
+    if (send(c->fd, buf, len, MSG_NOSIGNAL | MSG_DONTWAIT) == -1 &&
+        errno != EAGAIN) {
+        perror("send");
+    }
+}
+
+const char *attach(pid_t pid)
+{
+    if (find_tracee(pid) != NULL) {
+        return "already attached";
+    }
+    if (ntracees == MAX_TRACEES) {
+        return "too many tracees";
+    }
+    if (ptrace(PTRACE_SEIZE, pid, 0, PTRACE_O_TRACESYSGOOD) == -1) {
+        return strerror(errno);
+    }
+    // The resulting PTRACE_EVENT_STOP resumes it in the current mode
+    if (ptrace(PTRACE_INTERRUPT, pid, 0, 0) == -1) {
+        return strerror(errno);
+    }
+    struct tracee *t = &tracees[ntracees++];
+    memset(t, 0, sizeof(*t));
+    t->pid = pid;
+    t->nr = -1;
+    return NULL;
+}
+
+void resume(struct tracee *t, int sig)
+{
+    enum __ptrace_request request = tracing ? PTRACE_SYSCALL : PTRACE_CONT;
+    if (!tracing) {
+        // We won't see the exit of the current syscall
+        t->nr = -1;
+    }
+    if (ptrace(request, t->pid, 0, sig) == -1) {
+        perror("ptrace");
+    }
+}
+
+void interrupt_all(void)
+{
+    for (int i = 0; i < ntracees; i++) {
+        ptrace(PTRACE_INTERRUPT, tracees[i].pid, 0, 0);
+    }
+}
+
+void syscall_stop(struct tracee *t)
+{
+    struct __ptrace_syscall_info info;
+    if (ptrace(PTRACE_GET_SYSCALL_INFO, t->pid, sizeof(info), &info) == -1) {
+        perror("PTRACE_GET_SYSCALL_INFO");
+        return;
+    }
+
+    if (info.op == PTRACE_SYSCALL_INFO_ENTRY) {
+        t->nr = info.entry.nr;
+        t->entry_time = now_ms();
+    } else if (info.op == PTRACE_SYSCALL_INFO_EXIT && t->nr >= 0) {
+        double elapsed = now_ms() - t->entry_time;
+        if (t->nr < NSYSCALLS) {
+            t->counts[t->nr]++;
+            t->time[t->nr] += elapsed;
+        }
+        t->total++;
+        if (full_output) {
+            printf("[%d] %s() = %lld <%.3f ms>\n", t->pid,
+                   t->nr < NSYSCALLS ? syscalls[t->nr] : "?",
+                   (long long)info.exit.rval, elapsed);
+        }
+        t->nr = -1;
+    }
+}
+
+void handle_stop(pid_t pid, int status)
+{
+    struct tracee *t = find_tracee(pid);
+    if (t == NULL) {
+        return;
+    }
+
+    if (WIFEXITED(status) || WIFSIGNALED(status)) {
+        printf("[%d] Tracee terminated\n", pid);
+        remove_tracee(t);
+        return;
+    }
+
+    int sig = WSTOPSIG(status);
+    bool event_stop = status >> 16 == PTRACE_EVENT_STOP;
+    bool at_syscall = sig == (SIGTRAP | 0x80);
+
+    if (t->detaching) {
+        // Pass on the signal if this was a signal-delivery-stop
+        int inject = event_stop || at_syscall ? 0 : sig;
+        if (ptrace(PTRACE_DETACH, pid, 0, inject) == -1) {
+            perror("PTRACE_DETACH");
+        }
+        printf("[%d] Detached\n", pid);
+        remove_tracee(t);
+        return;
+    }
+
+    if (event_stop) {
+        if (sig == SIGTRAP) {
+            // Our PTRACE_INTERRUPT, or SIGCONT as described in p09.c
+            resume(t, 0);
+        } else if (ptrace(PTRACE_LISTEN, pid, 0, 0) == -1) {
+            perror("PTRACE_LISTEN");
+        }
+    } else if (at_syscall) {
+        syscall_stop(t);
+        resume(t, 0);
+    } else {
+        resume(t, sig);
+    }
+}
+
+void reap_tracees(void)
+{
+    int status;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, __WALL | WNOHANG)) > 0) {
+        handle_stop(pid, status);
+    }
+    if (pid == -1 && errno != ECHILD) {
+        perror("waitpid");
+    }
+}
+
+void print_stats(struct client *c)
+{
+    reply(c, "tracing %s, %s output, %d tracees\n",
+          tracing ? "on" : "off", full_output ? "full" : "summary", ntracees);
+    for (int i = 0; i < ntracees; i++) {
+        struct tracee *t = &tracees[i];
+        reply(c, "pid %d: %lu syscalls\n", t->pid, t->total);
+
+        // Print the ten most frequent syscalls
+        bool shown[NSYSCALLS] = { false };
+        for (int n = 0; n < 10; n++) {
+            int best = -1;
+            for (int nr = 0; nr < NSYSCALLS; nr++) {
+                if (!shown[nr] && t->counts[nr] > 0 &&
+                    (best == -1 || t->counts[nr] > t->counts[best])) {
+                    best = nr;
+                }
+            }
+            if (best == -1) {
+                break;
+            }
+            shown[best] = true;
+            reply(c, "  %-20s %10lu calls %12.3f ms\n", syscalls[best],
+                  t->counts[best], t->time[best]);
+        }
+    }
+}
+
+void handle_command(struct client *c, char *line)
+{
+    char cmd[32] = "", arg[32] = "";
+    sscanf(line, "%31s %31s", cmd, arg);
+
+    if (strcmp(cmd, "trace") == 0 &&
+        (strcmp(arg, "on") == 0 || strcmp(arg, "off") == 0)) {
+        bool on = strcmp(arg, "on") == 0;
+        if (on && !tracing) {
+            // The tracees run freely, stop them to switch to PTRACE_SYSCALL
+            interrupt_all();
+        }
+        tracing = on;
+    } else if (strcmp(cmd, "mode") == 0 &&
+               (strcmp(arg, "full") == 0 || strcmp(arg, "summary") == 0)) {
+        full_output = strcmp(arg, "full") == 0;
+    } else if (strcmp(cmd, "stats") == 0) {
+        print_stats(c);
+    } else if (strcmp(cmd, "reset") == 0) {
+        for (int i = 0; i < ntracees; i++) {
+            tracees[i].total = 0;
+            memset(tracees[i].counts, 0, sizeof(tracees[i].counts));
+            memset(tracees[i].time, 0, sizeof(tracees[i].time));
+        }
+    } else if (strcmp(cmd, "attach") == 0 && atoi(arg) > 0) {
+        const char *error = attach(atoi(arg));
+        if (error != NULL) {
+            reply(c, "error: %s\n", error);
+            return;
+        }
+    } else if (strcmp(cmd, "detach") == 0 && atoi(arg) > 0) {
+        struct tracee *t = find_tracee(atoi(arg));
+        if (t == NULL) {
+            reply(c, "error: not attached\n");
+            return;
+        }
+        t->detaching = true;
+        ptrace(PTRACE_INTERRUPT, t->pid, 0, 0);
+    } else if (strcmp(cmd, "list") == 0) {
+        for (int i = 0; i < ntracees; i++) {
+            reply(c, "%d%s\n", tracees[i].pid,
+                  tracees[i].detaching ? " (detaching)" : "");
+        }
+    } else if (strcmp(cmd, "quit") == 0) {
+        quitting = true;
+        for (int i = 0; i < ntracees; i++) {
+            tracees[i].detaching = true;
+        }
+        interrupt_all();
+    } else {
+        reply(c, "error: unknown command\n");
+        return;
+    }
+    reply(c, "ok\n");
+}
+
+void close_client(struct client *c)
+{
+    close(c->fd);
+    *c = clients[--nclients];
+}
+
+void handle_client(struct client *c)
+{
+    ssize_t n = read(c->fd, c->buf + c->len, sizeof(c->buf) - 1 - c->len);
+    if (n <= 0) {
+        close_client(c);
+        return;
+    }
+    c->len += n;
+    c->buf[c->len] = '\0';
+
+    char *line = c->buf, *end;
+    while ((end = strchr(line, '\n')) != NULL) {
+        *end = '\0';
+        handle_command(c, line);
+        line = end + 1;
+    }
+    c->len -= line - c->buf;
+    memmove(c->buf, line, c->len);
+    if (c->len == sizeof(c->buf) - 1) {
+        reply(c, "error: line too long\n");
+        close_client(c);
+    }
+}
+
+void accept_client(int listen_fd)
+{
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd == -1) {
+        perror("accept");
+        return;
+    }
+    if (nclients == MAX_CLIENTS) {
+        close(fd);
+        return;
+    }
+    clients[nclients].fd = fd;
+    clients[nclients].len = 0;
+    nclients++;
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.fd = fd };
+    epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+int open_control_socket(const char *path)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long\n");
+        exit(EXIT_FAILURE);
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    unlink(path);
+    if (fd == -1 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+        listen(fd, 8) == -1) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    return fd;
+}
+
+void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s <control-socket> [pid...]\n", name);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        usage(argv[0]);
+    }
+
+    // Signals we handle through the signalfd must be blocked
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1) {
+        perror("sigprocmask");
+        exit(EXIT_FAILURE);
+    }
+    int sfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (sfd == -1) {
+        perror("signalfd");
+        exit(EXIT_FAILURE);
+    }
+
+    int listen_fd = open_control_socket(argv[1]);
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd == -1) {
+        perror("epoll_create1");
+        exit(EXIT_FAILURE);
+    }
+    struct epoll_event ev = { .events = EPOLLIN, .data.fd = sfd };
+    epoll_ctl(epfd, EPOLL_CTL_ADD, sfd, &ev);
+    ev.data.fd = listen_fd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, listen_fd, &ev);
+
+    for (int i = 2; i < argc; i++) {
+        pid_t pid = atoi(argv[i]);
+        const char *error = pid > 0 ? attach(pid) : "invalid pid";
+        if (error != NULL) {
+            fprintf(stderr, "%s: %s\n", argv[i], error);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    while (!quitting || ntracees > 0) {
+        struct epoll_event events[MAX_EVENTS];
+        int n = epoll_wait(epfd, events, MAX_EVENTS, -1);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait");
+            exit(EXIT_FAILURE);
+        }
+
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if (fd == sfd) {
+                struct signalfd_siginfo si;
+                while (read(sfd, &si, sizeof(si)) == sizeof(si)) {
+                    if (si.ssi_signo != SIGCHLD && !quitting) {
+                        quitting = true;
+                        for (int j = 0; j < ntracees; j++) {
+                            tracees[j].detaching = true;
+                        }
+                        interrupt_all();
+                    }
+                }
+                reap_tracees();
+            } else if (fd == listen_fd) {
+                accept_client(listen_fd);
+            } else {
+                for (int j = 0; j < nclients; j++) {
+                    if (clients[j].fd == fd) {
+                        handle_client(&clients[j]);
+                        break;
+                    }
+                }
+            }
+        }
+        fflush(stdout);
+    }
+
+    unlink(argv[1]);
+    return 0;
+}
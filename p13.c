@@ -0,0 +1,643 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <sys/ptrace.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <signal.h>
+#include <time.h>
+
+/**
+ * Finds recurring sequences of syscalls, on x86_64.
+ *
+ * The flat output of p08.c and p09.c shows every syscall, but not the
+ * patterns that repeat, like fstat -> lseek -> read -> close for every
+ * request, which are usually where batching helps the most. This
+ * keeps a sliding window of the last five syscalls of every thread,
+ * and on every syscall-exit counts the sequences (n-grams) of length
+ * 2 to 5 that end with it, together with the time spent in them. On
+ * Ctrl-C, or when the tracee exits, it prints the most frequent
+ * sequences with a suggestion of a batching alternative when it
+ * recognizes one.
+ *
+ * An n-gram is packed into a 64-bit key with 12 bits per syscall
+ * number and its length in the top bits. There can be a huge number
+ * of different n-grams in a long run, so we can't keep a counter for
+ * each one. Instead every n-gram is added to a count-min sketch: a few
+ * rows of counters, each row indexed by a different hash of the key.
+ * Hash collisions can only make a counter too large, so the smallest
+ * of the counters for a key is an estimate that is never too small.
+ * Next to the sketch, a table holds the MAX_TRACKED n-grams with the
+ * highest estimates. Until the table is full every n-gram enters it the
+ * first time it is seen and is counted exactly. After that, an n-gram
+ * which isn't in the table replaces the smallest one once its estimate
+ * gets larger, and is counted exactly from there on, but it starts
+ * from its estimate, so its count can be too large. Such counts are
+ * marked with a ~ in the report. The total time is kept in a second
+ * sketch in the same way. So the memory use is fixed no matter how
+ * long we trace.
+ *
+ * A short sequence is always at least as frequent as a longer one
+ * which contains it, so the report leaves out n-grams that are (almost)
+ * always part of a longer one. A loop of more than five syscalls also
+ * shows up as several five-grams, each shifted by one syscall, so only
+ * the first of those is shown.
+ *
+ * All threads are traced, and new ones are followed with
+ * PTRACE_O_TRACECLONE. As in p12.c, PTRACE_GET_SYSCALL_INFO tells
+ * syscall-entry from syscall-exit, since we attach to the threads in
+ * the middle of whatever they are doing.
+ */
+
+char *syscalls[] =
+    {
+     "read", "write", "open", "close", "stat", "fstat", "lstat", "poll",
+     "lseek", "mmap", "mprotect", "munmap", "brk", "rt_sigaction",
+     "rt_sigprocmask", "rt_sigreturn", "ioctl", "pread64", "pwrite64", "readv",
+     "writev", "access", "pipe", "select", "sched_yield", "mremap", "msync",
+     "mincore", "madvise", "shmget", "shmat", "shmctl", "dup", "dup2", "pause",
+     "nanosleep", "getitimer", "alarm", "setitimer", "getpid", "sendfile",
+     "socket", "connect", "accept", "sendto", "recvfrom", "sendmsg", "recvmsg",
+     "shutdown", "bind", "listen", "getsockname", "getpeername", "socketpair",
+     "setsockopt", "getsockopt", "clone", "fork", "vfork", "execve", "exit",
+     "wait4", "kill", "uname", "semget", "semop", "semctl", "shmdt", "msgget",
+     "msgsnd", "msgrcv", "msgctl", "fcntl", "flock", "fsync", "fdatasync",
+     "truncate", "ftruncate", "getdents", "getcwd", "chdir", "fchdir", "rename",
+     "mkdir", "rmdir", "creat", "link", "unlink", "symlink", "readlink",
+     "chmod", "fchmod", "chown", "fchown", "lchown", "umask", "gettimeofday",
+     "getrlimit", "getrusage", "sysinfo", "times", "ptrace", "getuid", "syslog",
+     "getgid", "setuid", "setgid", "geteuid", "getegid", "setpgid", "getppid",
+     "getpgrp", "setsid", "setreuid", "setregid", "getgroups", "setgroups",
+     "setresuid", "getresuid", "setresgid", "getresgid", "getpgid", "setfsuid",
+     "setfsgid", "getsid", "capget", "capset", "rt_sigpending",
+     "rt_sigtimedwait", "rt_sigqueueinfo", "rt_sigsuspend", "sigaltstack",
+     "utime", "mknod", "uselib", "personality", "ustat", "statfs", "fstatfs",
+     "sysfs", "getpriority", "setpriority", "sched_setparam", "sched_getparam",
+     "sched_setscheduler", "sched_getscheduler", "sched_get_priority_max",
+     "sched_get_priority_min", "sched_rr_get_interval", "mlock", "munlock",
+     "mlockall", "munlockall", "vhangup", "modify_ldt", "pivot_root", "_sysctl",
+     "prctl", "arch_prctl", "adjtimex", "setrlimit", "chroot", "sync", "acct",
+     "settimeofday", "mount", "umount2", "swapon", "swapoff", "reboot",
+     "sethostname", "setdomainname", "iopl", "ioperm", "create_module",
+     "init_module", "delete_module", "get_kernel_syms", "query_module",
+     "quotactl", "nfsservctl", "getpmsg", "putpmsg", "afs_syscall", "tuxcall",
+     "security", "gettid", "readahead", "setxattr", "lsetxattr", "fsetxattr",
+     "getxattr", "lgetxattr", "fgetxattr", "listxattr", "llistxattr",
+     "flistxattr", "removexattr", "lremovexattr", "fremovexattr", "tkill",
+     "time", "futex", "sched_setaffinity", "sched_getaffinity",
+     "set_thread_area", "io_setup", "io_destroy", "io_getevents", "io_submit",
+     "io_cancel", "get_thread_area", "lookup_dcookie", "epoll_create",
+     "epoll_ctl_old", "epoll_wait_old", "remap_file_pages", "getdents64",
+     "set_tid_address", "restart_syscall", "semtimedop", "fadvise64",
+     "timer_create", "timer_settime", "timer_gettime", "timer_getoverrun",
+     "timer_delete", "clock_settime", "clock_gettime", "clock_getres",
+     "clock_nanosleep", "exit_group", "epoll_wait", "epoll_ctl", "tgkill",
+     "utimes", "vserver", "mbind", "set_mempolicy", "get_mempolicy", "mq_open",
+     "mq_unlink", "mq_timedsend", "mq_timedreceive", "mq_notify",
+     "mq_getsetattr", "kexec_load", "waitid", "add_key", "request_key",
+     "keyctl", "ioprio_set", "ioprio_get", "inotify_init", "inotify_add_watch",
+     "inotify_rm_watch", "migrate_pages", "openat", "mkdirat", "mknodat",
+     "fchownat", "futimesat", "newfstatat", "unlinkat", "renameat", "linkat",
+     "symlinkat", "readlinkat", "fchmodat", "faccessat", "pselect6", "ppoll",
+     "unshare", "set_robust_list", "get_robust_list", "splice", "tee",
+     "sync_file_range", "vmsplice", "move_pages", "utimensat", "epoll_pwait",
+     "signalfd", "timerfd_create", "eventfd", "fallocate", "timerfd_settime",
+     "timerfd_gettime", "accept4", "signalfd4", "eventfd2", "epoll_create1",
+     "dup3", "pipe2", "inotify_init1", "preadv", "pwritev", "rt_tgsigqueueinfo",
+     "perf_event_open", "recvmmsg", "fanotify_init", "fanotify_mark",
+     "prlimit64", "name_to_handle_at", "open_by_handle_at", "clock_adjtime",
+     "syncfs", "sendmmsg", "setns", "getcpu", "process_vm_readv",
+     "process_vm_writev", "kcmp", "finit_module", "sched_setattr",
+     "sched_getattr", "renameat2", "seccomp", "getrandom", "memfd_create",
+     "kexec_file_load", "bpf", "execveat", "userfaultfd", "membarrier",
+     "mlock2", "copy_file_range", "preadv2", "pwritev2", "pkey_mprotect",
+     "pkey_alloc", "pkey_free", "statx", "io_pgetevents", "rseq"
+    };
+
+#define NSYSCALLS ((int)(sizeof(syscalls) / sizeof(syscalls[0])))
+#define MAX_N 5
+#define MAX_TASKS 4096
+#define SKETCH_DEPTH 4
+#define SKETCH_WIDTH 4096
+#define MAX_TRACKED 1024
+#define INDEX_SIZE (2 * MAX_TRACKED)
+
+struct task {
+    pid_t tid;
+    long nr;
+    double entry_time;
+    int len;
+    long window[MAX_N];
+    double times[MAX_N];
+};
+
+struct ngram {
+    uint64_t key;
+    unsigned long count;
+    double time;
+    /* Started from the sketch estimate, may be too large */
+    bool estimated;
+};
+
+struct task tasks[MAX_TASKS];
+int ntasks;
+
+uint32_t sketch_counts[SKETCH_DEPTH][SKETCH_WIDTH];
+double sketch_times[SKETCH_DEPTH][SKETCH_WIDTH];
+unsigned long total_ngrams;
+
+struct ngram tracked[MAX_TRACKED];
+int ntracked;
+/* Open addressing index into tracked[], -1 for empty slots */
+int ngram_index[INDEX_SIZE];
+/* Never larger than the smallest count in tracked[] */
+unsigned long min_tracked_count;
+bool evicted;
+
+volatile sig_atomic_t interrupted;
+
+void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-t top] <pid>\n", name);
+    exit(EXIT_FAILURE);
+}
+
+double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/* n-gram keys */
+
+uint64_t pack(const long *nrs, int n)
+{
+    uint64_t key = (uint64_t)n << 60;
+    for (int i = 0; i < n; i++) {
+        key |= (uint64_t)(nrs[i] & 0xfff) << (12 * i);
+    }
+    return key;
+}
+
+int key_length(uint64_t key)
+{
+    return key >> 60;
+}
+
+int key_syscall(uint64_t key, int i)
+{
+    return (key >> (12 * i)) & 0xfff;
+}
+
+uint64_t hash(uint64_t key, int seed)
+{
+    // splitmix64 finalizer
+    key += 0x9e3779b97f4a7c15ULL * (seed + 1);
+    key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    key = (key ^ (key >> 27)) * 0x94d049bb133111ebULL;
+    return key ^ (key >> 31);
+}
+
+/* The table of tracked n-grams */
+
+int *index_slot(uint64_t key)
+{
+    int slot = hash(key, SKETCH_DEPTH) % INDEX_SIZE;
+    while (ngram_index[slot] != -1 && tracked[ngram_index[slot]].key != key) {
+        slot = (slot + 1) % INDEX_SIZE;
+    }
+    return &ngram_index[slot];
+}
+
+void index_remove(uint64_t key)
+{
+    int *p = index_slot(key);
+    int hole = p - ngram_index;
+    *p = -1;
+    // Move back entries that would otherwise no longer be found
+    for (int slot = (hole + 1) % INDEX_SIZE; ngram_index[slot] != -1;
+         slot = (slot + 1) % INDEX_SIZE) {
+        int home = hash(tracked[ngram_index[slot]].key, SKETCH_DEPTH) % INDEX_SIZE;
+        if ((slot > hole && (home <= hole || home > slot)) ||
+            (slot < hole && home <= hole && home > slot)) {
+            ngram_index[hole] = ngram_index[slot];
+            ngram_index[slot] = -1;
+            hole = slot;
+        }
+    }
+}
+
+int find_min_tracked(void)
+{
+    int min = 0;
+    for (int i = 1; i < ntracked; i++) {
+        if (tracked[i].count < tracked[min].count) {
+            min = i;
+        }
+    }
+    min_tracked_count = tracked[min].count;
+    return min;
+}
+
+void count_ngram(uint64_t key, double time)
+{
+    unsigned long estimate = ~0UL;
+    double time_estimate = 1e300;
+    for (int row = 0; row < SKETCH_DEPTH; row++) {
+        int col = hash(key, row) % SKETCH_WIDTH;
+        sketch_counts[row][col]++;
+        sketch_times[row][col] += time;
+        if (sketch_counts[row][col] < estimate) {
+            estimate = sketch_counts[row][col];
+        }
+        if (sketch_times[row][col] < time_estimate) {
+            time_estimate = sketch_times[row][col];
+        }
+    }
+    total_ngrams++;
+
+    int *slot = index_slot(key);
+    if (*slot != -1) {
+        tracked[*slot].count++;
+        tracked[*slot].time += time;
+        return;
+    }
+
+    int i;
+    bool estimated = false;
+    if (ntracked < MAX_TRACKED) {
+        // Nothing was evicted yet, so this is the first time we see it
+        i = ntracked++;
+        estimate = 1;
+        time_estimate = time;
+    } else {
+        if (estimate <= min_tracked_count) {
+            return;
+        }
+        // The cached minimum may be stale, find the real one
+        i = find_min_tracked();
+        if (estimate <= tracked[i].count) {
+            return;
+        }
+        index_remove(tracked[i].key);
+        slot = index_slot(key);
+        evicted = true;
+        estimated = true;
+    }
+    tracked[i].key = key;
+    tracked[i].count = estimate;
+    tracked[i].time = time_estimate;
+    tracked[i].estimated = estimated;
+    *slot = i;
+}
+
+/* Tracing */
+
+struct task *find_task(pid_t tid, bool create)
+{
+    for (int i = 0; i < ntasks; i++) {
+        if (tasks[i].tid == tid) {
+            return &tasks[i];
+        }
+    }
+    if (!create || ntasks == MAX_TASKS) {
+        return NULL;
+    }
+    memset(&tasks[ntasks], 0, sizeof(tasks[ntasks]));
+    tasks[ntasks].tid = tid;
+    tasks[ntasks].nr = -1;
+    return &tasks[ntasks++];
+}
+
+void syscall_exit(struct task *t)
+{
+    double elapsed = now_ms() - t->entry_time;
+    if (t->len == MAX_N) {
+        memmove(t->window, t->window + 1, (MAX_N - 1) * sizeof(t->window[0]));
+        memmove(t->times, t->times + 1, (MAX_N - 1) * sizeof(t->times[0]));
+        t->len--;
+    }
+    t->window[t->len] = t->nr;
+    t->times[t->len] = elapsed;
+    t->len++;
+
+    // The n-grams of length 2 to len that end with this syscall
+    double time = elapsed;
+    for (int n = 2; n <= t->len; n++) {
+        time += t->times[t->len - n];
+        count_ngram(pack(t->window + t->len - n, n), time);
+    }
+}
+
+void syscall_stop(struct task *t)
+{
+    struct __ptrace_syscall_info info;
+    if (ptrace(PTRACE_GET_SYSCALL_INFO, t->tid, sizeof(info), &info) == -1) {
+        return;
+    }
+    if (info.op == PTRACE_SYSCALL_INFO_ENTRY) {
+        t->nr = info.entry.nr;
+        t->entry_time = now_ms();
+    } else if (info.op == PTRACE_SYSCALL_INFO_EXIT && t->nr >= 0) {
+        if (t->nr < 0x1000) {
+            syscall_exit(t);
+        }
+        t->nr = -1;
+    }
+}
+
+int attach_threads(pid_t pid)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/task", pid);
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+
+    int found = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        pid_t tid = atoi(entry->d_name);
+        if (tid <= 0 || find_task(tid, false) != NULL) {
+            continue;
+        }
+        long options = PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE;
+        if (ptrace(PTRACE_SEIZE, tid, 0, options) == -1 ||
+            ptrace(PTRACE_INTERRUPT, tid, 0, 0) == -1) {
+            continue;
+        }
+        find_task(tid, true);
+        found++;
+    }
+    closedir(dir);
+    return found;
+}
+
+/* Report */
+
+bool ngram_contains(uint64_t outer, uint64_t inner)
+{
+    int n = key_length(outer), m = key_length(inner);
+    for (int start = 0; start + m <= n; start++) {
+        int i = 0;
+        while (i < m && key_syscall(outer, start + i) == key_syscall(inner, i)) {
+            i++;
+        }
+        if (i == m) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Tells if b is a shifted one syscall to the left, or the other way around */
+bool ngram_shifted(uint64_t a, uint64_t b)
+{
+    int n = key_length(a);
+    if (key_length(b) != n) {
+        return false;
+    }
+    bool ab = true, ba = true;
+    for (int i = 0; i + 1 < n; i++) {
+        ab = ab && key_syscall(a, i + 1) == key_syscall(b, i);
+        ba = ba && key_syscall(b, i + 1) == key_syscall(a, i);
+    }
+    return ab || ba;
+}
+
+/* Tells if n-gram i is (almost) always part of a longer one */
+bool contained(int i)
+{
+    struct ngram *g = &tracked[i];
+    for (int j = 0; j < ntracked; j++) {
+        if (key_length(tracked[j].key) > key_length(g->key) &&
+            tracked[j].count >= 0.9 * g->count &&
+            ngram_contains(tracked[j].key, g->key)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Tells if n-gram i is another window of a loop we have already
+ * seen. tracked[] is sorted, so the earlier ones have higher counts.
+ */
+bool same_loop(int i, const int *loop, int nloop)
+{
+    for (int j = 0; j < nloop; j++) {
+        if (ngram_shifted(tracked[loop[j]].key, tracked[i].key) &&
+            tracked[i].count >= 0.9 * tracked[loop[j]].count) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int count_in(uint64_t key, const int *nrs)
+{
+    int count = 0;
+    for (int i = 0; i < key_length(key); i++) {
+        for (const int *nr = nrs; *nr != -1; nr++) {
+            count += key_syscall(key, i) == *nr;
+        }
+    }
+    return count;
+}
+
+const char *suggestion(uint64_t key)
+{
+    static const int reads[] = { SYS_read, SYS_pread64, -1 };
+    static const int writes[] = { SYS_write, SYS_pwrite64, -1 };
+    static const int sends[] = { SYS_sendto, SYS_sendmsg, -1 };
+    static const int recvs[] = { SYS_recvfrom, SYS_recvmsg, -1 };
+    static const int epoll_ctl[] = { SYS_epoll_ctl, -1 };
+    static const int epoll_wait[] = { SYS_epoll_wait, SYS_epoll_pwait, -1 };
+    static const int polls[] = { SYS_poll, SYS_ppoll, SYS_select,
+                                 SYS_pselect6, -1 };
+    static const int opens[] = { SYS_open, SYS_openat, -1 };
+    static const int stats[] = { SYS_stat, SYS_fstat, SYS_lstat,
+                                 SYS_newfstatat, SYS_statx, -1 };
+    static const int seeks[] = { SYS_lseek, -1 };
+    static const int closes[] = { SYS_close, -1 };
+    static const int io[] = { SYS_read, SYS_write, SYS_pread64, SYS_pwrite64,
+                              SYS_readv, SYS_writev, SYS_open, SYS_openat,
+                              SYS_close, SYS_fstat, SYS_newfstatat, SYS_statx,
+                              SYS_sendto, SYS_recvfrom, SYS_sendmsg,
+                              SYS_recvmsg, SYS_fsync, SYS_fdatasync, -1 };
+
+    if (count_in(key, opens) && count_in(key, closes) &&
+        (count_in(key, stats) || count_in(key, reads))) {
+        return "keep the file open, or batch open/read/close with io_uring";
+    }
+    if ((count_in(key, stats) || count_in(key, seeks)) && count_in(key, reads)) {
+        return "pread64 at a known offset instead of fstat/lseek + read";
+    }
+    if (count_in(key, epoll_ctl) && count_in(key, epoll_wait)) {
+        return "register fds once with EPOLLET instead of epoll_ctl per wait";
+    }
+    if (count_in(key, epoll_ctl) >= 2) {
+        return "fewer epoll_ctl calls, e.g. edge-triggered registration";
+    }
+    if (count_in(key, polls)) {
+        return "epoll instead of re-submitting the fd set to poll/select";
+    }
+    if (count_in(key, reads) >= 2) {
+        return "readv/preadv or a larger buffer";
+    }
+    if (count_in(key, writes) >= 2) {
+        return "writev/pwritev, or buffer the writes";
+    }
+    if (count_in(key, sends) >= 2) {
+        return "sendmmsg";
+    }
+    if (count_in(key, recvs) >= 2) {
+        return "recvmmsg";
+    }
+    if (count_in(key, io) >= 3) {
+        return "submit the sequence as one io_uring batch";
+    }
+    return "";
+}
+
+int compare_count(const void *a, const void *b)
+{
+    const struct ngram *x = a, *y = b;
+    return x->count < y->count ? 1 : x->count > y->count ? -1 : 0;
+}
+
+void report(int top)
+{
+    qsort(tracked, ntracked, sizeof(tracked[0]), compare_count);
+
+    unsigned long width = SKETCH_WIDTH;
+    printf("\n%lu n-grams counted, %d tracked", total_ngrams, ntracked);
+    if (evicted) {
+        printf(" (counts marked ~ may be over-estimated by up to %lu)",
+               (unsigned long)(2.72 * total_ngrams / width));
+    }
+    printf("\n\n%10s %12s %10s  %s\n", "count", "total ms", "avg us",
+           "sequence");
+
+    int loop[MAX_TRACKED];
+    int nloop = 0, shown = 0;
+    for (int i = 0; i < ntracked && shown < top; i++) {
+        struct ngram *g = &tracked[i];
+        if (contained(i)) {
+            continue;
+        }
+        bool repeat = same_loop(i, loop, nloop);
+        loop[nloop++] = i;
+        if (repeat) {
+            continue;
+        }
+        shown++;
+
+        printf("%10lu%c%12.3f %10.1f  ", g->count, g->estimated ? '~' : ' ',
+               g->time, 1e3 * g->time / g->count);
+        for (int k = 0; k < key_length(g->key); k++) {
+            int nr = key_syscall(g->key, k);
+            printf("%s%s", k > 0 ? " -> " : "",
+                   nr < NSYSCALLS ? syscalls[nr] : "?");
+        }
+        const char *hint = suggestion(g->key);
+        if (*hint != '\0') {
+            printf("\n%36s try: %s", "", hint);
+        }
+        printf("\n");
+    }
+}
+
+void on_interrupt(int sig)
+{
+    (void)sig;
+    interrupted = 1;
+}
+
+int main(int argc, char *argv[])
+{
+    int top = 20;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:")) != -1) {
+        if (opt == 't') {
+            top = atoi(optarg);
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (argc - optind != 1) {
+        usage(argv[0]);
+    }
+    pid_t pid = atoi(argv[optind]);
+    if (pid <= 0) {
+        usage(argv[0]);
+    }
+
+    memset(ngram_index, -1, sizeof(ngram_index));
+
+    // No SA_RESTART, so that waitpid returns with EINTR
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_interrupt;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    while (attach_threads(pid) > 0) {
+    }
+    if (ntasks == 0) {
+        fprintf(stderr, "Could not attach to %d\n", pid);
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stderr, "Attached to %d threads, press Ctrl-C to stop\n", ntasks);
+
+    while (!interrupted) {
+        int status;
+        pid_t tid = waitpid(-1, &status, __WALL);
+        if (tid == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        if (WIFEXITED(status) || WIFSIGNALED(status)) {
+            struct task *t = find_task(tid, false);
+            if (t != NULL) {
+                *t = tasks[--ntasks];
+            }
+            continue;
+        }
+
+        // Threads created with clone are attached automatically
+        struct task *t = find_task(tid, true);
+        int sig = WSTOPSIG(status);
+        int inject = 0;
+        if (status >> 16 == PTRACE_EVENT_STOP) {
+            if (sig != SIGTRAP) {
+                ptrace(PTRACE_LISTEN, tid, 0, 0);
+                continue;
+            }
+        } else if (sig == (SIGTRAP | 0x80)) {
+            if (t != NULL) {
+                syscall_stop(t);
+            }
+        } else if (status >> 16 == 0) {
+            inject = sig;
+        }
+        ptrace(PTRACE_SYSCALL, tid, 0, inject);
+    }
+
+    // The tracees are detached and resumed when we exit
+    report(top);
+    return 0;
+}
@@ -0,0 +1,844 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/ptrace.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <signal.h>
+#include <time.h>
+
+/**
+ * Measures the time from execve until a program is ready to serve,
+ * and breaks it down, on x86_64. For example:
+ *
+ *   ./p14 -r listen -s before.txt ./server
+ *   ./p14 -r listen -c before.txt ./server
+ *
+ * The program is launched under ptrace like in p05.c, but with
+ * PTRACE_O_EXITKILL, and all its threads and child processes are
+ * followed. The clock starts at the entry of execve, and tracing stops
+ * at the readiness marker given with -r:
+ *
+ *   listen        the first listen, accept or accept4 (the default)
+ *   epoll         the first epoll_wait or epoll_pwait
+ *   write:<path>  the first write to the file <path>, which may not
+ *                 exist yet. It is compared to what /proc/<pid>/fd
+ *                 says the written fd is, so relative paths and
+ *                 symlinks in the directories work.
+ *
+ * The program is then killed (by PTRACE_O_EXITKILL, when we exit)
+ * since we only care about how it starts.
+ *
+ * To attribute time we need to know what the file descriptors refer
+ * to, so we follow open, creat, socket, dup and close, and remember the path
+ * of each file descriptor. The syscalls are then put into categories:
+ *
+ *   dynamic linker   everything the dynamic linker does after exec
+ *   libraries        shared libraries loaded later, with dlopen
+ *   config files     files in /etc and files named *.conf, *.json etc
+ *   dns/network      sockets, and resolv.conf, hosts and nsswitch.conf
+ *   sleeping         nanosleep, and poll or select without any fds
+ *   other            the rest
+ *
+ * I wasn't sure how to tell when the dynamic linker is done. It turns
+ * out that glibc's ld.so maps /etc/ld.so.cache, loads all the
+ * libraries, and unmaps the cache before it does the relocations, so
+ * I use that munmap as the end of the phase. That misses the time
+ * spent on relocations, but that time isn't spent in syscalls anyway.
+ * If the cache is never opened, the phase ends at the first syscall
+ * that the dynamic linker doesn't make.
+ *
+ * For each shared library the time from its open to its close is
+ * reported as its load time. ld.so closes the file once it has mapped
+ * its segments. The times are added up over all processes, and the
+ * libraries that took the longest are shown.
+ *
+ * The syscall times are summed over all threads and processes, so
+ * they can add up to more than the time to ready.
+ *
+ * With -s the results are saved to a file, and with -c they are
+ * compared to those saved from an earlier run.
+ */
+
+#define MAX_FDS 1024
+#define MAX_PROCS 64
+#define MAX_TASKS 1024
+#define MAX_LIBS 256
+#define MAX_SAVED 512
+#define TOP_LIBS 15
+
+enum category {
+    C_LINKER, C_LIBRARY, C_CONFIG, C_NETWORK, C_SLEEP, C_OTHER, NCATEGORIES
+};
+
+const char *category_names[] = {
+    "dynamic linker", "libraries", "config files", "dns/network",
+    "sleeping", "other"
+};
+
+enum fd_kind { FD_NONE, FD_FILE, FD_CACHE, FD_LIB, FD_CONFIG, FD_DNS, FD_SOCKET };
+
+struct fd {
+    enum fd_kind kind;
+    char *path;
+    int lib;
+    double open_time;
+};
+
+struct process {
+    pid_t pid;
+    /* Number of tasks, the slot is free again when it drops to 0 */
+    int ntasks;
+    bool in_linker;
+    uint64_t cache_addr;
+    struct fd fds[MAX_FDS];
+};
+
+struct task {
+    pid_t tid;
+    bool started;
+    struct process *proc;
+    long nr;
+    uint64_t args[6];
+    double entry_time;
+    char path[PATH_MAX];
+};
+
+struct lib {
+    char *path;
+    int loads;
+    double load_time;
+};
+
+struct process procs[MAX_PROCS];
+
+struct task tasks[MAX_TASKS];
+int ntasks;
+
+struct lib libs[MAX_LIBS];
+int nlibs;
+
+double category_time[NCATEGORIES];
+
+pid_t child;
+double exec_time = -1;
+double linker_start;
+double linker_time;
+double ready_time = -1;
+double main_syscall_time;
+
+enum { READY_LISTEN, READY_EPOLL, READY_WRITE } ready_marker = READY_LISTEN;
+char ready_path[PATH_MAX];
+
+void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-r listen|epoll|write:<path>] [-s file] "
+            "[-c file] <program> [args...]\n", name);
+    exit(EXIT_FAILURE);
+}
+
+double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+void read_string(pid_t pid, uint64_t addr, char *buf, size_t size)
+{
+    for (size_t i = 0; i < size; i += sizeof(long)) {
+        errno = 0;
+        long word = ptrace(PTRACE_PEEKDATA, pid, addr + i, 0);
+        if (errno != 0) {
+            buf[i] = '\0';
+            return;
+        }
+        size_t n = size - i < sizeof(long) ? size - i : sizeof(long);
+        memcpy(buf + i, &word, n);
+        if (memchr(&word, '\0', n) != NULL) {
+            return;
+        }
+    }
+    buf[size - 1] = '\0';
+}
+
+bool ends_with(const char *s, const char *suffix)
+{
+    size_t len = strlen(s), n = strlen(suffix);
+    return len >= n && strcmp(s + len - n, suffix) == 0;
+}
+
+enum fd_kind classify_path(const char *path)
+{
+    static const char *dns[] = {
+        "/etc/resolv.conf", "/etc/hosts", "/etc/nsswitch.conf",
+        "/etc/gai.conf", "/etc/host.conf", NULL
+    };
+    static const char *config[] = {
+        ".conf", ".cfg", ".ini", ".json", ".yaml", ".yml", ".toml", NULL
+    };
+
+    if (strcmp(path, "/etc/ld.so.cache") == 0) {
+        return FD_CACHE;
+    }
+    const char *base = strrchr(path, '/');
+    base = base ? base + 1 : path;
+    if (ends_with(base, ".so") || strstr(base, ".so.") != NULL) {
+        return FD_LIB;
+    }
+    for (int i = 0; dns[i] != NULL; i++) {
+        if (strcmp(path, dns[i]) == 0) {
+            return FD_DNS;
+        }
+    }
+    if (strncmp(path, "/etc/", 5) == 0) {
+        return FD_CONFIG;
+    }
+    for (int i = 0; config[i] != NULL; i++) {
+        if (ends_with(base, config[i])) {
+            return FD_CONFIG;
+        }
+    }
+    return FD_FILE;
+}
+
+/*
+ * Makes a path absolute and without symlinks, like readlink on
+ * /proc/<pid>/fd shows it. The file itself doesn't have to exist.
+ */
+void resolve_path(const char *path, char *buf, size_t size)
+{
+    char dir[PATH_MAX], resolved[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s", path);
+    char *slash = strrchr(dir, '/');
+    const char *base = path;
+    if (slash == NULL) {
+        strcpy(dir, ".");
+    } else {
+        base = path + (slash - dir) + 1;
+        *slash = '\0';
+        if (slash == dir) {
+            strcpy(dir, "/");
+        }
+    }
+    if (realpath(dir, resolved) == NULL) {
+        snprintf(buf, size, "%s", path);
+    } else {
+        snprintf(buf, size, "%s%s%s", resolved,
+                 strcmp(resolved, "/") == 0 ? "" : "/", base);
+    }
+}
+
+/* Processes and tasks */
+
+void copy_fds(struct process *to, struct process *from)
+{
+    for (int fd = 0; fd < MAX_FDS; fd++) {
+        to->fds[fd] = from->fds[fd];
+        if (to->fds[fd].path != NULL) {
+            to->fds[fd].path = strdup(to->fds[fd].path);
+        }
+        if (to->fds[fd].kind == FD_LIB) {
+            to->fds[fd].kind = FD_FILE;
+        }
+    }
+}
+
+struct process *new_process(pid_t pid, struct process *parent)
+{
+    int i = 0;
+    while (i < MAX_PROCS && procs[i].ntasks > 0) {
+        i++;
+    }
+    if (i == MAX_PROCS) {
+        fprintf(stderr, "Too many processes\n");
+        exit(EXIT_FAILURE);
+    }
+    struct process *p = &procs[i];
+    memset(p, 0, sizeof(*p));
+    p->pid = pid;
+    if (parent != NULL) {
+        copy_fds(p, parent);
+    }
+    return p;
+}
+
+struct task *find_task(pid_t tid)
+{
+    for (int i = 0; i < ntasks; i++) {
+        if (tasks[i].tid == tid) {
+            return &tasks[i];
+        }
+    }
+    return NULL;
+}
+
+void set_process(struct task *t, struct process *proc)
+{
+    t->proc = proc;
+    if (proc != NULL) {
+        proc->ntasks++;
+    }
+}
+
+struct task *new_task(pid_t tid, struct process *proc)
+{
+    if (ntasks == MAX_TASKS) {
+        fprintf(stderr, "Too many threads\n");
+        exit(EXIT_FAILURE);
+    }
+    struct task *t = &tasks[ntasks++];
+    memset(t, 0, sizeof(*t));
+    t->tid = tid;
+    t->nr = -1;
+    set_process(t, proc);
+    return t;
+}
+
+void remove_task(struct task *t)
+{
+    struct process *p = t->proc;
+    if (p != NULL && --p->ntasks == 0) {
+        // Whatever is still open is closed by the kernel, not loaded
+        for (int fd = 0; fd < MAX_FDS; fd++) {
+            free(p->fds[fd].path);
+        }
+    }
+    *t = tasks[--ntasks];
+}
+
+struct fd *get_fd(struct process *p, uint64_t fd)
+{
+    return fd < MAX_FDS ? &p->fds[fd] : NULL;
+}
+
+void close_fd(struct process *p, uint64_t fd, double now)
+{
+    struct fd *f = get_fd(p, fd);
+    if (f == NULL) {
+        return;
+    }
+    if (f->kind == FD_LIB) {
+        libs[f->lib].load_time += now - f->open_time;
+        libs[f->lib].loads++;
+    }
+    free(f->path);
+    memset(f, 0, sizeof(*f));
+}
+
+void set_fd(struct process *p, uint64_t fd, enum fd_kind kind,
+            const char *path, double open_time)
+{
+    close_fd(p, fd, open_time);
+    struct fd *f = get_fd(p, fd);
+    if (f == NULL) {
+        return;
+    }
+    f->kind = kind;
+    f->path = path ? strdup(path) : NULL;
+    if (kind != FD_LIB) {
+        return;
+    }
+    // The same library is loaded by every process that runs, so the
+    // load times are added up per path
+    int lib = 0;
+    while (lib < nlibs && strcmp(libs[lib].path, path) != 0) {
+        lib++;
+    }
+    if (lib == MAX_LIBS) {
+        f->kind = FD_FILE;
+        return;
+    }
+    if (lib == nlibs) {
+        libs[nlibs++].path = strdup(path);
+    }
+    // Kept per fd, other processes may load the same library meanwhile
+    f->lib = lib;
+    f->open_time = open_time;
+}
+
+/* Syscalls */
+
+bool is_linker_syscall(long nr)
+{
+    static const long loader[] = {
+        SYS_brk, SYS_arch_prctl, SYS_access, SYS_open, SYS_openat, SYS_read,
+        SYS_pread64, SYS_fstat, SYS_newfstatat, SYS_mmap, SYS_mprotect,
+        SYS_munmap, SYS_close, SYS_stat
+    };
+    for (size_t i = 0; i < sizeof(loader) / sizeof(loader[0]); i++) {
+        if (loader[i] == nr) {
+            return true;
+        }
+    }
+    return false;
+}
+
+enum category fd_category(struct process *p, uint64_t fd)
+{
+    struct fd *f = get_fd(p, fd);
+    if (f == NULL) {
+        return C_OTHER;
+    }
+    switch (f->kind) {
+    case FD_LIB:
+    case FD_CACHE:
+        return C_LIBRARY;
+    case FD_CONFIG:
+        return C_CONFIG;
+    case FD_DNS:
+    case FD_SOCKET:
+        return C_NETWORK;
+    default:
+        return C_OTHER;
+    }
+}
+
+void check_ready(struct task *t, bool entry, int64_t ret)
+{
+    if (ready_time >= 0) {
+        return;
+    }
+    long nr = t->nr;
+    bool ready = false;
+    switch (ready_marker) {
+    case READY_LISTEN:
+        ready = (!entry && nr == SYS_listen && ret == 0) ||
+            (entry && (nr == SYS_accept || nr == SYS_accept4));
+        break;
+    case READY_EPOLL:
+        ready = entry && (nr == SYS_epoll_wait || nr == SYS_epoll_pwait);
+        break;
+    case READY_WRITE:
+        if (!entry && ret > 0 &&
+            (nr == SYS_write || nr == SYS_pwrite64 || nr == SYS_writev)) {
+            char link[64], path[PATH_MAX];
+            snprintf(link, sizeof(link), "/proc/%d/fd/%d", t->tid,
+                     (int)t->args[0]);
+            ssize_t len = readlink(link, path, sizeof(path) - 1);
+            if (len > 0) {
+                path[len] = '\0';
+                ready = strcmp(path, ready_path) == 0;
+            }
+        }
+        break;
+    }
+    if (ready) {
+        ready_time = now_ms();
+    }
+}
+
+void syscall_entry(struct task *t, long nr, const uint64_t args[6])
+{
+    t->nr = nr;
+    memcpy(t->args, args, sizeof(t->args));
+    t->path[0] = '\0';
+    if (nr == SYS_open || nr == SYS_creat) {
+        read_string(t->tid, args[0], t->path, sizeof(t->path));
+    } else if (nr == SYS_openat) {
+        read_string(t->tid, args[1], t->path, sizeof(t->path));
+    } else if (nr == SYS_execve && t->tid == child && exec_time < 0) {
+        exec_time = now_ms();
+    }
+
+    struct process *p = t->proc;
+    if (p->pid == child && p->in_linker && p->cache_addr == 0 &&
+        !is_linker_syscall(nr) && nr != SYS_execve) {
+        // The cache was never used, so this wasn't the dynamic linker
+        p->in_linker = false;
+        linker_time += now_ms() - linker_start;
+    }
+    t->entry_time = now_ms();
+    check_ready(t, true, 0);
+}
+
+void syscall_exit(struct task *t, int64_t ret)
+{
+    double now = now_ms();
+    double elapsed = now - t->entry_time;
+    struct process *p = t->proc;
+    enum category category = C_OTHER;
+    uint64_t *args = t->args;
+
+    switch (t->nr) {
+    case SYS_open:
+    case SYS_openat:
+    case SYS_creat:
+        if (ret >= 0) {
+            set_fd(p, ret, classify_path(t->path), t->path, t->entry_time);
+        }
+        category = fd_category(p, ret);
+        if (ret < 0) {
+            enum fd_kind kind = classify_path(t->path);
+            category = kind == FD_LIB || kind == FD_CACHE ? C_LIBRARY :
+                kind == FD_CONFIG ? C_CONFIG :
+                kind == FD_DNS ? C_NETWORK : C_OTHER;
+        }
+        break;
+    case SYS_socket:
+        if (ret >= 0) {
+            set_fd(p, ret, FD_SOCKET, NULL, now);
+        }
+        category = C_NETWORK;
+        break;
+    case SYS_dup:
+    case SYS_dup2:
+    case SYS_dup3:
+        if (ret >= 0 && get_fd(p, args[0]) != NULL && (uint64_t)ret != args[0]) {
+            struct fd *f = get_fd(p, args[0]);
+            enum fd_kind kind = f->kind == FD_LIB ? FD_FILE : f->kind;
+            set_fd(p, ret, kind, f->path, now);
+        }
+        break;
+    case SYS_mmap:
+        category = fd_category(p, args[4]);
+        if ((int64_t)ret > 0 && get_fd(p, args[4]) != NULL &&
+            get_fd(p, args[4])->kind == FD_CACHE && p->cache_addr == 0) {
+            p->cache_addr = ret;
+        }
+        break;
+    case SYS_munmap:
+        if (p->cache_addr != 0 && args[0] == p->cache_addr && p->in_linker) {
+            p->in_linker = false;
+            if (p->pid == child) {
+                linker_time += now - linker_start;
+            }
+        }
+        break;
+    case SYS_close:
+        category = fd_category(p, args[0]);
+        close_fd(p, args[0], now);
+        break;
+    case SYS_read:
+    case SYS_pread64:
+    case SYS_readv:
+    case SYS_write:
+    case SYS_pwrite64:
+    case SYS_writev:
+    case SYS_fstat:
+    case SYS_lseek:
+        category = fd_category(p, args[0]);
+        break;
+    case SYS_connect:
+    case SYS_bind:
+    case SYS_setsockopt:
+    case SYS_getsockopt:
+    case SYS_getsockname:
+    case SYS_getpeername:
+    case SYS_sendto:
+    case SYS_recvfrom:
+    case SYS_sendmsg:
+    case SYS_recvmsg:
+    case SYS_sendmmsg:
+    case SYS_recvmmsg:
+    case SYS_shutdown:
+        category = C_NETWORK;
+        break;
+    case SYS_nanosleep:
+    case SYS_clock_nanosleep:
+    case SYS_pause:
+        category = C_SLEEP;
+        break;
+    case SYS_poll:
+    case SYS_ppoll:
+    case SYS_select:
+    case SYS_pselect6:
+        category = args[0] == 0 ? C_SLEEP : C_OTHER;
+        break;
+    case SYS_execve:
+        if (ret == 0) {
+            // Only syscalls after a successful exec count as the linker's
+            t->nr = -1;
+            return;
+        }
+        break;
+    }
+
+    if (p->in_linker && p->pid == child) {
+        category = C_LINKER;
+    }
+    if (exec_time >= 0) {
+        category_time[category] += elapsed;
+        if (t->tid == child) {
+            main_syscall_time += elapsed;
+        }
+        check_ready(t, false, ret);
+    }
+    t->nr = -1;
+}
+
+void exec_event(struct task *t)
+{
+    // The new program starts with only the files without O_CLOEXEC,
+    // but we don't know which those are, so keep them all
+    t->proc->in_linker = true;
+    t->proc->cache_addr = 0;
+    if (t->proc->pid == child) {
+        linker_start = now_ms();
+    }
+}
+
+void new_child_event(struct task *t, int event)
+{
+    unsigned long tid;
+    ptrace(PTRACE_GETEVENTMSG, t->tid, 0, &tid);
+    // Threads share the file descriptors of the process
+    struct process *p = event == PTRACE_EVENT_CLONE ? t->proc :
+        new_process(tid, t->proc);
+    struct task *c = find_task(tid);
+    if (c == NULL) {
+        new_task(tid, p);
+    } else {
+        // It stopped first and has been waiting for this event
+        set_process(c, p);
+        c->started = true;
+        ptrace(PTRACE_SYSCALL, tid, 0, 0);
+    }
+}
+
+/* Results */
+
+struct saved {
+    char key[PATH_MAX + 8];
+    double value;
+};
+
+struct saved results[MAX_SAVED];
+int nresults;
+
+void add_result(const char *key, double value)
+{
+    if (nresults < MAX_SAVED) {
+        snprintf(results[nresults].key, sizeof(results[nresults].key), "%s", key);
+        results[nresults].value = value;
+        nresults++;
+    }
+}
+
+int compare_load_time(const void *a, const void *b)
+{
+    const struct lib *x = a, *y = b;
+    return x->load_time < y->load_time ? 1 : x->load_time > y->load_time ? -1 : 0;
+}
+
+void collect_results(void)
+{
+    double end = ready_time >= 0 ? ready_time : now_ms();
+    add_result("time to ready", end - exec_time);
+    // procs[0] is the process we launched
+    if (procs[0].in_linker) {
+        linker_time += end - linker_start;
+    }
+    add_result("dynamic linker phase", linker_time);
+    for (int c = 0; c < NCATEGORIES; c++) {
+        char key[64];
+        snprintf(key, sizeof(key), "syscalls: %s", category_names[c]);
+        add_result(key, category_time[c]);
+    }
+    add_result("main thread outside syscalls",
+               end - exec_time - main_syscall_time);
+
+    qsort(libs, nlibs, sizeof(libs[0]), compare_load_time);
+    for (int i = 0; i < nlibs && i < TOP_LIBS; i++) {
+        if (libs[i].loads > 0) {
+            char key[PATH_MAX + 8];
+            snprintf(key, sizeof(key), "lib: %s", libs[i].path);
+            add_result(key, libs[i].load_time);
+        }
+    }
+}
+
+void print_results(void)
+{
+    if (ready_time < 0) {
+        printf("Exited before the readiness marker was seen\n");
+    }
+    for (int i = 0; i < nresults; i++) {
+        printf("%-60s %10.3f ms\n", results[i].key, results[i].value);
+    }
+}
+
+void save_results(const char *path)
+{
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < nresults; i++) {
+        fprintf(f, "%.6f\t%s\n", results[i].value, results[i].key);
+    }
+    fclose(f);
+}
+
+void compare_results(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    struct saved *before = calloc(MAX_SAVED, sizeof(*before));
+    int nbefore = 0;
+    char line[PATH_MAX + 64];
+    while (nbefore < MAX_SAVED && fgets(line, sizeof(line), f) != NULL) {
+        char *tab = strchr(line, '\t');
+        if (tab == NULL) {
+            continue;
+        }
+        tab[strcspn(tab, "\n")] = '\0';
+        before[nbefore].value = atof(line);
+        snprintf(before[nbefore].key, sizeof(before[nbefore].key), "%s", tab + 1);
+        nbefore++;
+    }
+    fclose(f);
+
+    printf("%-60s %12s %12s %12s\n", "", "before ms", "after ms", "change");
+    for (int i = 0; i < nresults; i++) {
+        int j = 0;
+        while (j < nbefore && strcmp(before[j].key, results[i].key) != 0) {
+            j++;
+        }
+        if (j == nbefore) {
+            printf("%-60s %12s %12.3f %12s\n", results[i].key, "-",
+                   results[i].value, "new");
+            continue;
+        }
+        double delta = results[i].value - before[j].value;
+        printf("%-60s %12.3f %12.3f %+11.1f%%\n", results[i].key,
+               before[j].value, results[i].value,
+               before[j].value > 0 ? 100 * delta / before[j].value : 0.0);
+        before[j].key[0] = '\0';
+    }
+    for (int j = 0; j < nbefore; j++) {
+        if (before[j].key[0] != '\0') {
+            printf("%-60s %12.3f %12s %12s\n", before[j].key, before[j].value,
+                   "-", "gone");
+        }
+    }
+    free(before);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *save_path = NULL, *compare_path = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "+r:s:c:")) != -1) {
+        switch (opt) {
+        case 'r':
+            if (strcmp(optarg, "listen") == 0) {
+                ready_marker = READY_LISTEN;
+            } else if (strcmp(optarg, "epoll") == 0) {
+                ready_marker = READY_EPOLL;
+            } else if (strncmp(optarg, "write:", 6) == 0) {
+                ready_marker = READY_WRITE;
+                resolve_path(optarg + 6, ready_path, sizeof(ready_path));
+            } else {
+                usage(argv[0]);
+            }
+            break;
+        case 's':
+            save_path = optarg;
+            break;
+        case 'c':
+            compare_path = optarg;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind == argc) {
+        usage(argv[0]);
+    }
+
+    child = fork();
+    if (child == 0) {
+        ptrace(PTRACE_TRACEME, 0, 0, 0);
+        raise(SIGSTOP);
+        execvp(argv[optind], argv + optind);
+        perror(argv[optind]);
+        exit(EXIT_FAILURE);
+    }
+
+    int status;
+    if (waitpid(child, &status, __WALL) == -1) {
+        perror("waitpid");
+        exit(EXIT_FAILURE);
+    }
+    long options = PTRACE_O_TRACESYSGOOD | PTRACE_O_EXITKILL |
+        PTRACE_O_TRACEEXEC | PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK |
+        PTRACE_O_TRACECLONE;
+    if (ptrace(PTRACE_SETOPTIONS, child, 0, options) == -1) {
+        perror("PTRACE_SETOPTIONS");
+        exit(EXIT_FAILURE);
+    }
+    new_task(child, new_process(child, NULL))->started = true;
+    ptrace(PTRACE_SYSCALL, child, 0, 0);
+
+    pid_t tid;
+    while (ready_time < 0 && (tid = waitpid(-1, &status, __WALL)) != -1) {
+        struct task *t = find_task(tid);
+        if (WIFEXITED(status) || WIFSIGNALED(status)) {
+            if (tid == child) {
+                // procs[] still holds the launched process for the results
+                break;
+            }
+            if (t != NULL) {
+                remove_task(t);
+            }
+            continue;
+        }
+        if (t == NULL) {
+            // A new task may stop before its parent reports the event,
+            // it stays stopped until then
+            new_task(tid, NULL);
+            continue;
+        }
+
+        int sig = WSTOPSIG(status);
+        int event = status >> 16;
+        int inject = 0;
+        if (sig == (SIGTRAP | 0x80)) {
+            struct __ptrace_syscall_info info;
+            ptrace(PTRACE_GET_SYSCALL_INFO, tid, sizeof(info), &info);
+            if (info.op == PTRACE_SYSCALL_INFO_ENTRY) {
+                syscall_entry(t, info.entry.nr, info.entry.args);
+            } else if (info.op == PTRACE_SYSCALL_INFO_EXIT && t->nr >= 0) {
+                syscall_exit(t, info.exit.rval);
+            }
+        } else if (event == PTRACE_EVENT_EXEC) {
+            exec_event(t);
+        } else if (event == PTRACE_EVENT_FORK || event == PTRACE_EVENT_VFORK ||
+                   event == PTRACE_EVENT_CLONE) {
+            new_child_event(t, event);
+        } else if (event == 0 && (sig != SIGSTOP || t->started)) {
+            // New tasks start with a SIGSTOP that isn't meant for them
+            inject = sig;
+        }
+        t->started = true;
+        ptrace(PTRACE_SYSCALL, tid, 0, inject);
+    }
+
+    if (exec_time < 0) {
+        fprintf(stderr, "The program was never executed\n");
+        exit(EXIT_FAILURE);
+    }
+    collect_results();
+    if (compare_path != NULL) {
+        compare_results(compare_path);
+    } else {
+        print_results();
+    }
+    if (save_path != NULL) {
+        save_results(save_path);
+    }
+    // PTRACE_O_EXITKILL kills the program when we exit
+    return 0;
+}
@@ -0,0 +1,704 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/ptrace.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/futex.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <signal.h>
+#include <time.h>
+
+/**
+ * Finds the most contended futexes (mutexes, condition variables and
+ * so on) of a process, on x86_64.
+ *
+ * In p08.c and p09.c a stalled thread pool only shows up as a lot of
+ * futex calls. Here every futex call is decoded at syscall-entry (the
+ * operation, uaddr and timeout) and timed until syscall-exit. The
+ * results are added up per futex address:
+ *
+ *   wait ms    total time threads were blocked waiting on it
+ *   waits      number of waits (FUTEX_WAIT, WAIT_BITSET, LOCK_PI ...)
+ *   waiters    number of different threads that waited
+ *   timeouts   waits that ended with ETIMEDOUT
+ *   wakes      number of wake calls (FUTEX_WAKE, WAKE_OP, UNLOCK_PI ...)
+ *   fan-out    threads woken per wake call that woke anyone
+ *   empty      wake calls that didn't wake anyone
+ *   futile     waiters that were woken but waited on it again right
+ *              away, without making any other syscall in between
+ *
+ * It also adds up which thread woke which waiter. A wake call can't
+ * tell us whom it woke, but the waker has entered the wake call before
+ * the waiter returns, so we blame the last thread that entered a wake
+ * call on that address. The waiter may be reported to us before the
+ * waker's syscall-exit, which is why this isn't done at exit.
+ *
+ * The addresses are resolved through /proc/<pid>/maps, and then
+ * through the symbol table of the mapped file when there is one, so
+ * that a global mutex shows up as for example libfoo.so:cache_lock. A
+ * global in .bss can end up in the anonymous mapping that follows the
+ * last mapping of the file, so such a mapping is treated as part of the
+ * file. A mutex on the heap can only be shown as [heap]+offset. The
+ * maps are read when the report is made, or, if the process exits,
+ * when the thread group leader reaches PTRACE_EVENT_EXIT, where the
+ * address space still exists.
+ *
+ * Pass -v to print every futex call. As in p13.c, all threads are
+ * traced and the report is printed on Ctrl-C or when the process
+ * exits. The counts of FUTEX_REQUEUE and FUTEX_CMP_REQUEUE include the
+ * requeued waiters since their return value doesn't tell them apart.
+ */
+
+#define MAX_TASKS 4096
+#define MAX_LOCKS 8192
+#define MAX_PAIRS 8192
+#define MAX_WAITERS 16
+#define MAX_MAPS 4096
+#define MAX_OBJECTS 256
+
+struct task {
+    pid_t tid;
+    bool in_futex;
+    int cmd;
+    uint64_t uaddr;
+    uint64_t uaddr2;
+    double entry_time;
+    /* The futex this thread was last woken from, if nothing happened since */
+    uint64_t woken_from;
+};
+
+struct lock {
+    uint64_t uaddr;
+    double wait_time;
+    double max_wait;
+    unsigned long waits;
+    unsigned long timeouts;
+    unsigned long wake_calls;
+    unsigned long woken;
+    unsigned long empty_wakes;
+    unsigned long futile;
+    pid_t waiters[MAX_WAITERS];
+    int nwaiters;
+    pid_t last_waker;
+};
+
+struct pair {
+    uint64_t uaddr;
+    pid_t waker;
+    unsigned long count;
+    double wait_time;
+};
+
+struct map {
+    uint64_t start;
+    uint64_t end;
+    uint64_t offset;
+    char path[PATH_MAX];
+};
+
+/* A mapped ELF file and its symbols */
+struct object {
+    char *path;
+    const char *data;
+    size_t size;
+    const Elf64_Phdr *phdrs;
+    int nphdrs;
+    const Elf64_Sym *syms;
+    int nsyms;
+    const char *strtab;
+};
+
+struct task tasks[MAX_TASKS];
+int ntasks;
+
+struct lock locks[MAX_LOCKS];
+int nlocks;
+unsigned long dropped;
+
+struct pair pairs[MAX_PAIRS];
+int npairs;
+
+struct map maps[MAX_MAPS];
+int nmaps;
+
+struct object objects[MAX_OBJECTS];
+int nobjects;
+
+pid_t pid;
+bool verbose;
+volatile sig_atomic_t interrupted;
+
+const char *op_names[] = {
+    "FUTEX_WAIT", "FUTEX_WAKE", "FUTEX_FD", "FUTEX_REQUEUE",
+    "FUTEX_CMP_REQUEUE", "FUTEX_WAKE_OP", "FUTEX_LOCK_PI", "FUTEX_UNLOCK_PI",
+    "FUTEX_TRYLOCK_PI", "FUTEX_WAIT_BITSET", "FUTEX_WAKE_BITSET",
+    "FUTEX_WAIT_REQUEUE_PI", "FUTEX_CMP_REQUEUE_PI", "FUTEX_LOCK_PI2"
+};
+
+#define NOPS ((int)(sizeof(op_names) / sizeof(op_names[0])))
+
+void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-v] [-t top] <pid>\n", name);
+    exit(EXIT_FAILURE);
+}
+
+double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+bool is_wait(int cmd)
+{
+    return cmd == FUTEX_WAIT || cmd == FUTEX_WAIT_BITSET ||
+        cmd == FUTEX_WAIT_REQUEUE_PI || cmd == FUTEX_LOCK_PI ||
+        cmd == FUTEX_LOCK_PI2;
+}
+
+bool is_wake(int cmd)
+{
+    return cmd == FUTEX_WAKE || cmd == FUTEX_WAKE_BITSET ||
+        cmd == FUTEX_WAKE_OP || cmd == FUTEX_REQUEUE ||
+        cmd == FUTEX_CMP_REQUEUE || cmd == FUTEX_CMP_REQUEUE_PI ||
+        cmd == FUTEX_UNLOCK_PI;
+}
+
+uint64_t hash(uint64_t key)
+{
+    key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    key = (key ^ (key >> 27)) * 0x94d049bb133111ebULL;
+    return key ^ (key >> 31);
+}
+
+/* Lock and pair tables, with open addressing */
+
+int lock_index[2 * MAX_LOCKS];
+int pair_index[2 * MAX_PAIRS];
+
+struct lock *find_lock(uint64_t uaddr)
+{
+    int slot = hash(uaddr) % (2 * MAX_LOCKS);
+    while (lock_index[slot] != -1) {
+        if (locks[lock_index[slot]].uaddr == uaddr) {
+            return &locks[lock_index[slot]];
+        }
+        slot = (slot + 1) % (2 * MAX_LOCKS);
+    }
+    if (nlocks == MAX_LOCKS) {
+        dropped++;
+        return NULL;
+    }
+    lock_index[slot] = nlocks;
+    memset(&locks[nlocks], 0, sizeof(locks[nlocks]));
+    locks[nlocks].uaddr = uaddr;
+    return &locks[nlocks++];
+}
+
+struct pair *find_pair(uint64_t uaddr, pid_t waker)
+{
+    int slot = hash(uaddr ^ ((uint64_t)waker << 48)) % (2 * MAX_PAIRS);
+    while (pair_index[slot] != -1) {
+        struct pair *p = &pairs[pair_index[slot]];
+        if (p->uaddr == uaddr && p->waker == waker) {
+            return p;
+        }
+        slot = (slot + 1) % (2 * MAX_PAIRS);
+    }
+    if (npairs == MAX_PAIRS) {
+        dropped++;
+        return NULL;
+    }
+    pair_index[slot] = npairs;
+    memset(&pairs[npairs], 0, sizeof(pairs[npairs]));
+    pairs[npairs].uaddr = uaddr;
+    pairs[npairs].waker = waker;
+    return &pairs[npairs++];
+}
+
+void add_waiter(struct lock *l, pid_t tid)
+{
+    for (int i = 0; i < l->nwaiters; i++) {
+        if (l->waiters[i] == tid) {
+            return;
+        }
+    }
+    if (l->nwaiters < MAX_WAITERS) {
+        l->waiters[l->nwaiters++] = tid;
+    }
+}
+
+/* Futex calls */
+
+struct task *find_task(pid_t tid, bool create)
+{
+    for (int i = 0; i < ntasks; i++) {
+        if (tasks[i].tid == tid) {
+            return &tasks[i];
+        }
+    }
+    if (!create || ntasks == MAX_TASKS) {
+        return NULL;
+    }
+    memset(&tasks[ntasks], 0, sizeof(tasks[ntasks]));
+    tasks[ntasks].tid = tid;
+    return &tasks[ntasks++];
+}
+
+void print_timeout(pid_t tid, int cmd, int op, uint64_t addr)
+{
+    if (addr == 0 || (cmd != FUTEX_WAIT && cmd != FUTEX_WAIT_BITSET &&
+                      cmd != FUTEX_LOCK_PI && cmd != FUTEX_LOCK_PI2 &&
+                      cmd != FUTEX_WAIT_REQUEUE_PI)) {
+        return;
+    }
+    errno = 0;
+    long sec = ptrace(PTRACE_PEEKDATA, tid, addr, 0);
+    long nsec = ptrace(PTRACE_PEEKDATA, tid, addr + sizeof(long), 0);
+    if (errno != 0) {
+        return;
+    }
+    // Only FUTEX_WAIT takes a relative timeout
+    printf(", timeout=%s%ld.%09ld%s", cmd == FUTEX_WAIT ? "" : "abs ",
+           sec, nsec, op & FUTEX_CLOCK_REALTIME ? " realtime" : "");
+}
+
+void futex_entry(struct task *t, const uint64_t args[6])
+{
+    int op = args[1];
+    t->in_futex = true;
+    t->cmd = op & FUTEX_CMD_MASK;
+    t->uaddr = args[0];
+    t->uaddr2 = args[4];
+    t->entry_time = now_ms();
+
+    if (is_wait(t->cmd)) {
+        struct lock *l = find_lock(t->uaddr);
+        if (l != NULL && t->woken_from == t->uaddr) {
+            // Woken up, only to go back to sleep on the same futex
+            l->futile++;
+        }
+    } else if (is_wake(t->cmd)) {
+        struct lock *l = find_lock(t->uaddr);
+        if (l != NULL) {
+            l->last_waker = t->tid;
+        }
+        if (t->cmd == FUTEX_WAKE_OP && (l = find_lock(t->uaddr2)) != NULL) {
+            l->last_waker = t->tid;
+        }
+    }
+
+    if (verbose) {
+        printf("[%d] %s%s(uaddr=%#llx, val=%llu", t->tid,
+               t->cmd < NOPS ? op_names[t->cmd] : "FUTEX_?",
+               op & FUTEX_PRIVATE_FLAG ? "_PRIVATE" : "",
+               (unsigned long long)args[0], (unsigned long long)args[2]);
+        print_timeout(t->tid, t->cmd, op, args[3]);
+        printf(")\n");
+    }
+}
+
+void futex_exit(struct task *t, int64_t ret)
+{
+    double elapsed = now_ms() - t->entry_time;
+    t->in_futex = false;
+    t->woken_from = 0;
+    struct lock *l = find_lock(t->uaddr);
+    if (l == NULL) {
+        return;
+    }
+
+    if (is_wait(t->cmd)) {
+        l->waits++;
+        l->wait_time += elapsed;
+        if (elapsed > l->max_wait) {
+            l->max_wait = elapsed;
+        }
+        l->timeouts += ret == -ETIMEDOUT;
+        add_waiter(l, t->tid);
+        if (ret == 0 && l->last_waker != 0) {
+            struct pair *p = find_pair(t->uaddr, l->last_waker);
+            if (p != NULL) {
+                p->count++;
+                p->wait_time += elapsed;
+            }
+            t->woken_from = t->uaddr;
+        }
+    } else if (is_wake(t->cmd) && ret >= 0) {
+        l->wake_calls++;
+        l->woken += ret;
+        l->empty_wakes += ret == 0;
+    }
+
+    if (verbose) {
+        printf("[%d] %s = %lld <%.3f ms>\n", t->tid,
+               t->cmd < NOPS ? op_names[t->cmd] : "FUTEX_?",
+               (long long)ret, elapsed);
+    }
+}
+
+void syscall_stop(struct task *t)
+{
+    struct __ptrace_syscall_info info;
+    if (ptrace(PTRACE_GET_SYSCALL_INFO, t->tid, sizeof(info), &info) == -1) {
+        return;
+    }
+    if (info.op == PTRACE_SYSCALL_INFO_ENTRY) {
+        if (info.entry.nr == SYS_futex) {
+            futex_entry(t, info.entry.args);
+        } else {
+            t->woken_from = 0;
+        }
+    } else if (info.op == PTRACE_SYSCALL_INFO_EXIT && t->in_futex) {
+        futex_exit(t, info.exit.rval);
+    }
+}
+
+int attach_threads(void)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/task", pid);
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+
+    int found = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        pid_t tid = atoi(entry->d_name);
+        if (tid <= 0 || find_task(tid, false) != NULL) {
+            continue;
+        }
+        long options = PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE |
+            PTRACE_O_TRACEEXIT;
+        if (ptrace(PTRACE_SEIZE, tid, 0, options) == -1 ||
+            ptrace(PTRACE_INTERRUPT, tid, 0, 0) == -1) {
+            continue;
+        }
+        find_task(tid, true);
+        found++;
+    }
+    closedir(dir);
+    return found;
+}
+
+/* Symbols */
+
+void read_maps(void)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/maps", pid);
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        return;
+    }
+    // Keep the old maps if the address space is already gone
+    int n = 0;
+    char line[PATH_MAX + 128];
+    while (n < MAX_MAPS && fgets(line, sizeof(line), f) != NULL) {
+        struct map *m = &maps[n];
+        int name_pos = 0;
+        unsigned long start, end, offset;
+        if (sscanf(line, "%lx-%lx %*s %lx %*s %*u %n",
+                   &start, &end, &offset, &name_pos) < 3) {
+            continue;
+        }
+        m->start = start;
+        m->end = end;
+        m->offset = offset;
+        snprintf(m->path, sizeof(m->path), "%s", line + name_pos);
+        m->path[strcspn(m->path, "\n")] = '\0';
+        n++;
+    }
+    fclose(f);
+    if (n > 0) {
+        nmaps = n;
+    }
+}
+
+struct object *load_object(const char *path)
+{
+    for (int i = 0; i < nobjects; i++) {
+        if (strcmp(objects[i].path, path) == 0) {
+            return objects[i].data ? &objects[i] : NULL;
+        }
+    }
+    if (nobjects == MAX_OBJECTS) {
+        return NULL;
+    }
+    struct object *o = &objects[nobjects++];
+    memset(o, 0, sizeof(*o));
+    o->path = strdup(path);
+
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(Elf64_Ehdr)) {
+        if (fd != -1) {
+            close(fd);
+        }
+        return NULL;
+    }
+    const char *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+
+    const Elf64_Ehdr *ehdr = (const Elf64_Ehdr *)data;
+    if (memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0 ||
+        ehdr->e_ident[EI_CLASS] != ELFCLASS64 ||
+        ehdr->e_phoff + ehdr->e_phnum * sizeof(Elf64_Phdr) > (size_t)st.st_size ||
+        ehdr->e_shoff + ehdr->e_shnum * sizeof(Elf64_Shdr) > (size_t)st.st_size) {
+        munmap((void *)data, st.st_size);
+        return NULL;
+    }
+    o->data = data;
+    o->size = st.st_size;
+    o->phdrs = (const Elf64_Phdr *)(data + ehdr->e_phoff);
+    o->nphdrs = ehdr->e_phnum;
+
+    // Prefer the full symbol table, fall back to the dynamic one
+    const Elf64_Shdr *shdrs = (const Elf64_Shdr *)(data + ehdr->e_shoff);
+    for (int type = SHT_SYMTAB; o->syms == NULL && type >= SHT_SYMTAB;
+         type = type == SHT_SYMTAB ? SHT_DYNSYM : -1) {
+        for (int i = 0; i < ehdr->e_shnum; i++) {
+            const Elf64_Shdr *sh = &shdrs[i];
+            if (sh->sh_type != (Elf64_Word)type || sh->sh_link >= ehdr->e_shnum ||
+                sh->sh_offset + sh->sh_size > (size_t)st.st_size) {
+                continue;
+            }
+            o->syms = (const Elf64_Sym *)(data + sh->sh_offset);
+            o->nsyms = sh->sh_size / sizeof(Elf64_Sym);
+            o->strtab = data + shdrs[sh->sh_link].sh_offset;
+            break;
+        }
+    }
+    return o;
+}
+
+/* Finds the symbol containing the file offset, returns false if none */
+bool find_symbol(struct object *o, uint64_t offset, const char **name,
+                 uint64_t *sym_offset)
+{
+    uint64_t vaddr = 0;
+    bool found = false;
+    for (int i = 0; i < o->nphdrs; i++) {
+        const Elf64_Phdr *ph = &o->phdrs[i];
+        if (ph->p_type == PT_LOAD && offset >= ph->p_offset &&
+            offset < ph->p_offset + ph->p_memsz) {
+            vaddr = ph->p_vaddr + (offset - ph->p_offset);
+            found = true;
+            break;
+        }
+    }
+    for (int i = 0; found && i < o->nsyms; i++) {
+        const Elf64_Sym *sym = &o->syms[i];
+        if (sym->st_name != 0 && sym->st_shndx != SHN_UNDEF &&
+            vaddr >= sym->st_value && vaddr < sym->st_value + sym->st_size) {
+            *name = o->strtab + sym->st_name;
+            *sym_offset = vaddr - sym->st_value;
+            return true;
+        }
+    }
+    return false;
+}
+
+void describe_address(uint64_t addr, char *buf, size_t size)
+{
+    int i = 0;
+    while (i < nmaps && !(addr >= maps[i].start && addr < maps[i].end)) {
+        i++;
+    }
+    if (i == nmaps) {
+        snprintf(buf, size, "?");
+        return;
+    }
+
+    // An anonymous mapping right after a file may be its .bss
+    uint64_t offset = maps[i].offset + (addr - maps[i].start);
+    if (maps[i].path[0] == '\0' && i > 0 && maps[i - 1].end == maps[i].start &&
+        maps[i - 1].path[0] == '/') {
+        i--;
+        offset = maps[i].offset + (addr - maps[i].start);
+    }
+
+    const char *path = maps[i].path;
+    if (path[0] != '/') {
+        snprintf(buf, size, "%s+0x%llx", path[0] ? path : "anon",
+                 (unsigned long long)(addr - maps[i].start));
+        return;
+    }
+    const char *base = strrchr(path, '/') + 1;
+    struct object *o = load_object(path);
+    const char *name;
+    uint64_t sym_offset;
+    if (o != NULL && find_symbol(o, offset, &name, &sym_offset)) {
+        snprintf(buf, size, "%s:%s+0x%llx", base, name,
+                 (unsigned long long)sym_offset);
+    } else {
+        snprintf(buf, size, "%s+0x%llx", base, (unsigned long long)offset);
+    }
+}
+
+/* Report */
+
+int compare_wait_time(const void *a, const void *b)
+{
+    const struct lock *x = a, *y = b;
+    return x->wait_time < y->wait_time ? 1 : x->wait_time > y->wait_time ? -1 : 0;
+}
+
+int compare_pair_time(const void *a, const void *b)
+{
+    const struct pair *x = a, *y = b;
+    return x->wait_time < y->wait_time ? 1 : x->wait_time > y->wait_time ? -1 : 0;
+}
+
+void report(int top)
+{
+    char where[PATH_MAX + 64];
+
+    qsort(locks, nlocks, sizeof(locks[0]), compare_wait_time);
+    printf("\n%-18s %-40s %10s %7s %7s %9s %8s %7s %7s %6s %6s\n",
+           "uaddr", "location", "wait ms", "waits", "waiters", "max ms",
+           "timeouts", "wakes", "fan-out", "empty", "futile");
+    for (int i = 0; i < nlocks && i < top; i++) {
+        struct lock *l = &locks[i];
+        if (l->waits == 0 && l->wake_calls == 0) {
+            continue;
+        }
+        unsigned long useful = l->wake_calls - l->empty_wakes;
+        describe_address(l->uaddr, where, sizeof(where));
+        printf("%#-18llx %-40s %10.3f %7lu %6d%s %9.3f %8lu %7lu %7.2f %6lu %6lu\n",
+               (unsigned long long)l->uaddr, where, l->wait_time, l->waits,
+               l->nwaiters, l->nwaiters == MAX_WAITERS ? "+" : " ",
+               l->max_wait, l->timeouts, l->wake_calls,
+               useful > 0 ? (double)l->woken / useful : 0.0,
+               l->empty_wakes, l->futile);
+    }
+
+    qsort(pairs, npairs, sizeof(pairs[0]), compare_pair_time);
+    printf("\n%-18s %-40s %8s %8s %10s\n", "uaddr", "location", "waker",
+           "woken", "wait ms");
+    for (int i = 0; i < npairs && i < top; i++) {
+        struct pair *p = &pairs[i];
+        describe_address(p->uaddr, where, sizeof(where));
+        printf("%#-18llx %-40s %8d %8lu %10.3f\n",
+               (unsigned long long)p->uaddr, where, p->waker, p->count,
+               p->wait_time);
+    }
+    if (dropped > 0) {
+        printf("\n%lu futex calls not counted, too many addresses\n", dropped);
+    }
+}
+
+void on_interrupt(int sig)
+{
+    (void)sig;
+    interrupted = 1;
+}
+
+int main(int argc, char *argv[])
+{
+    int top = 20;
+    int opt;
+    while ((opt = getopt(argc, argv, "vt:")) != -1) {
+        switch (opt) {
+        case 'v':
+            verbose = true;
+            break;
+        case 't':
+            top = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (argc - optind != 1) {
+        usage(argv[0]);
+    }
+    pid = atoi(argv[optind]);
+    if (pid <= 0) {
+        usage(argv[0]);
+    }
+
+    memset(lock_index, -1, sizeof(lock_index));
+    memset(pair_index, -1, sizeof(pair_index));
+
+    // No SA_RESTART, so that waitpid returns with EINTR
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_interrupt;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    while (attach_threads() > 0) {
+    }
+    if (ntasks == 0) {
+        fprintf(stderr, "Could not attach to %d\n", pid);
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stderr, "Attached to %d threads, press Ctrl-C to stop\n", ntasks);
+
+    while (!interrupted) {
+        int status;
+        pid_t tid = waitpid(-1, &status, __WALL);
+        if (tid == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        if (WIFEXITED(status) || WIFSIGNALED(status)) {
+            struct task *t = find_task(tid, false);
+            if (t != NULL) {
+                *t = tasks[--ntasks];
+            }
+            continue;
+        }
+
+        struct task *t = find_task(tid, true);
+        int sig = WSTOPSIG(status);
+        int event = status >> 16;
+        int inject = 0;
+        if (event == PTRACE_EVENT_STOP) {
+            if (sig != SIGTRAP) {
+                ptrace(PTRACE_LISTEN, tid, 0, 0);
+                continue;
+            }
+        } else if (event == PTRACE_EVENT_EXIT) {
+            if (tid == pid) {
+                // Possibly our last chance to see the address space
+                read_maps();
+            }
+        } else if (sig == (SIGTRAP | 0x80)) {
+            if (t != NULL) {
+                syscall_stop(t);
+            }
+        } else if (event == 0) {
+            inject = sig;
+        }
+        ptrace(PTRACE_SYSCALL, tid, 0, inject);
+    }
+
+    read_maps();
+    // The tracees are detached and resumed when we exit
+    report(top);
+    return 0;
+}
@@ -0,0 +1,1005 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <sys/ptrace.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <sys/select.h>
+#include <poll.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <signal.h>
+#include <time.h>
+
+/**
+ * Shows how well the event loops of a process work, on x86_64.
+ *
+ * A server built around epoll_wait looks the same in p08.c and p09.c
+ * whether it is idle, healthy or drowning. Here the results of
+ * epoll_wait, epoll_pwait, epoll_pwait2, poll, ppoll, select and
+ * pselect6 are decoded at syscall-exit, which gives for every thread
+ * that waits on them (an event loop):
+ *
+ *   - how many waits returned events, timed out, were non-blocking
+ *     checks (a zero timeout) or were interrupted, and a histogram of
+ *     the number of events per wakeup. A wakeup that fills all of
+ *     maxevents is counted as full, a sign that maxevents is too small
+ *     or the loop is falling behind.
+ *   - the time spent waiting versus handling, and percentiles of the
+ *     handling time between a wakeup and the next wait. Like in p09.c,
+ *     the tracing itself makes every syscall in a handler slower.
+ *   - the number of epoll_ctl calls per wakeup, split into add, mod and
+ *     del. Re-arming fds with EPOLL_CTL_MOD for every event is usually
+ *     the largest part of this.
+ *   - the I/O syscalls (read, write, recv*, send*, accept ...) on the
+ *     fds that the last wakeup reported as ready. An EAGAIN as the first
+ *     I/O on a ready fd means the readiness was spurious, typically
+ *     because several threads were woken for the same fd. An EAGAIN
+ *     after some progress is the normal end of draining an
+ *     edge-triggered fd. A wakeup after which none of the ready fds had
+ *     any successful I/O before the next wait is counted as wasted.
+ *     Loops that hand the fds over to other threads will show all of
+ *     their wakeups as wasted.
+ *   - the share of events from edge-triggered fds, and the number of
+ *     fds that are reported again by the next wakeup without having
+ *     been touched in between, which happens when a level-triggered fd
+ *     is left undrained.
+ *
+ * epoll_wait returns the user data that was registered with the fd, not
+ * the fd itself, so the registrations are followed through epoll_ctl,
+ * close and dup2. Those from before we attached are read from
+ * /proc/<pid>/fdinfo/<epfd> the first time an epoll fd is used, which
+ * lists the fd, events and data of every registration. Events whose
+ * data we can't map back to an fd count as handled.
+ *
+ * Pass -v to print every wakeup. As in p15.c, all threads are traced
+ * and the report, with a few hints, is printed on Ctrl-C or when the
+ * process exits.
+ */
+
+#ifndef SYS_epoll_pwait2
+#define SYS_epoll_pwait2 441
+#endif
+
+#define MAX_TASKS 4096
+#define MAX_LOOPS 256
+#define MAX_READY 1024
+#define MAX_POLLFDS 4096
+#define MAX_REGS 65536
+#define MAX_EPFDS 256
+#define BATCH_BUCKETS 8
+#define TIME_BUCKETS 32
+
+/* What happened to a ready fd since the wakeup */
+enum { UNTOUCHED, PROGRESS, SPURIOUS };
+
+struct ready {
+    int fd;
+    uint32_t events;
+    int state;
+};
+
+struct loop {
+    pid_t tid;
+    char comm[32];
+    unsigned long waits;
+    unsigned long wakeups;
+    unsigned long timeouts;
+    unsigned long polls;
+    unsigned long interrupted;
+    unsigned long events;
+    unsigned long full;
+    int maxevents;
+    unsigned long batches[BATCH_BUCKETS];
+    double wait_time;
+    double busy_time;
+    unsigned long handled;
+    unsigned long handler_times[TIME_BUCKETS];
+    double max_handler;
+    unsigned long ctl_add;
+    unsigned long ctl_mod;
+    unsigned long ctl_del;
+    unsigned long edge_events;
+    unsigned long epoll_events;
+    unsigned long repeats;
+    unsigned long io_ready;
+    unsigned long spurious;
+    unsigned long drained;
+    unsigned long eagain_other;
+    unsigned long wasted;
+    /* The fds of the last wakeup */
+    struct ready ready[MAX_READY];
+    int nready;
+    bool unknown;
+    bool useful;
+    double last_exit;
+};
+
+struct task {
+    pid_t tid;
+    struct loop *loop;
+    long nr;
+    uint64_t args[6];
+    double entry_time;
+    /* Whether the wait in progress can block, see blocking() */
+    bool blocks;
+    /* The event of an epoll_ctl in progress */
+    struct epoll_event ctl_event;
+    bool ctl_event_ok;
+};
+
+/* An fd registered with an epoll fd */
+struct reg {
+    int epfd;
+    int fd;
+    uint32_t events;
+    uint64_t data;
+    bool active;
+};
+
+struct task tasks[MAX_TASKS];
+int ntasks;
+
+struct loop loops[MAX_LOOPS];
+int nloops;
+
+struct reg regs[MAX_REGS];
+int nregs;
+unsigned long dropped;
+
+int epfds[MAX_EPFDS];
+int nepfds;
+
+pid_t pid;
+bool verbose;
+volatile sig_atomic_t interrupted;
+
+void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-v] <pid>\n", name);
+    exit(EXIT_FAILURE);
+}
+
+double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+uint64_t hash(uint64_t key)
+{
+    key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    key = (key ^ (key >> 27)) * 0x94d049bb133111ebULL;
+    return key ^ (key >> 31);
+}
+
+bool read_memory(pid_t tid, uint64_t addr, void *buf, size_t size)
+{
+    struct iovec local = { buf, size };
+    struct iovec remote = { (void *)addr, size };
+    return process_vm_readv(tid, &local, 1, &remote, 1, 0) == (ssize_t)size;
+}
+
+bool is_wait(long nr)
+{
+    return nr == SYS_epoll_wait || nr == SYS_epoll_pwait ||
+        nr == SYS_epoll_pwait2 || nr == SYS_poll || nr == SYS_ppoll ||
+        nr == SYS_select || nr == SYS_pselect6;
+}
+
+bool is_epoll(long nr)
+{
+    return nr == SYS_epoll_wait || nr == SYS_epoll_pwait ||
+        nr == SYS_epoll_pwait2;
+}
+
+bool is_io(long nr)
+{
+    return nr == SYS_read || nr == SYS_write || nr == SYS_readv ||
+        nr == SYS_writev || nr == SYS_recvfrom || nr == SYS_sendto ||
+        nr == SYS_recvmsg || nr == SYS_sendmsg || nr == SYS_recvmmsg ||
+        nr == SYS_sendmmsg || nr == SYS_accept || nr == SYS_accept4 ||
+        nr == SYS_sendfile;
+}
+
+const char *wait_name(long nr)
+{
+    switch (nr) {
+    case SYS_epoll_wait: return "epoll_wait";
+    case SYS_epoll_pwait: return "epoll_pwait";
+    case SYS_epoll_pwait2: return "epoll_pwait2";
+    case SYS_poll: return "poll";
+    case SYS_ppoll: return "ppoll";
+    case SYS_select: return "select";
+    case SYS_pselect6: return "pselect6";
+    }
+    return "?";
+}
+
+/* Registrations, indexed by epfd and fd, and by epfd and data */
+
+int reg_by_fd[2 * MAX_REGS];
+int reg_by_data[2 * MAX_REGS];
+
+struct reg *find_reg(int epfd, int fd, bool create)
+{
+    int slot = hash((uint64_t)epfd << 32 | (uint32_t)fd) % (2 * MAX_REGS);
+    while (reg_by_fd[slot] != -1) {
+        struct reg *r = &regs[reg_by_fd[slot]];
+        if (r->epfd == epfd && r->fd == fd) {
+            return r;
+        }
+        slot = (slot + 1) % (2 * MAX_REGS);
+    }
+    if (!create || nregs == MAX_REGS) {
+        return NULL;
+    }
+    reg_by_fd[slot] = nregs;
+    memset(&regs[nregs], 0, sizeof(regs[nregs]));
+    regs[nregs].epfd = epfd;
+    regs[nregs].fd = fd;
+    return &regs[nregs++];
+}
+
+/*
+ * Only active registrations are in the data index, each in one slot,
+ * so it can't fill up.
+ */
+int data_home(int epfd, uint64_t data)
+{
+    return hash(data ^ (uint64_t)epfd << 48) % (2 * MAX_REGS);
+}
+
+struct reg *lookup_data(int epfd, uint64_t data)
+{
+    int slot = data_home(epfd, data);
+    while (reg_by_data[slot] != -1) {
+        struct reg *r = &regs[reg_by_data[slot]];
+        if (r->epfd == epfd && r->data == data) {
+            return r;
+        }
+        slot = (slot + 1) % (2 * MAX_REGS);
+    }
+    return NULL;
+}
+
+void index_data(struct reg *r)
+{
+    int slot = data_home(r->epfd, r->data);
+    while (reg_by_data[slot] != -1) {
+        slot = (slot + 1) % (2 * MAX_REGS);
+    }
+    reg_by_data[slot] = r - regs;
+}
+
+/* Called before the data of the registration changes */
+void unindex_data(struct reg *r)
+{
+    int hole = data_home(r->epfd, r->data);
+    while (reg_by_data[hole] != r - regs) {
+        hole = (hole + 1) % (2 * MAX_REGS);
+    }
+    reg_by_data[hole] = -1;
+    // Move back entries that would otherwise no longer be found
+    for (int slot = (hole + 1) % (2 * MAX_REGS); reg_by_data[slot] != -1;
+         slot = (slot + 1) % (2 * MAX_REGS)) {
+        struct reg *moved = &regs[reg_by_data[slot]];
+        int home = data_home(moved->epfd, moved->data);
+        if ((slot > hole && (home <= hole || home > slot)) ||
+            (slot < hole && home <= hole && home > slot)) {
+            reg_by_data[hole] = reg_by_data[slot];
+            reg_by_data[slot] = -1;
+            hole = slot;
+        }
+    }
+}
+
+void remove_reg(struct reg *r)
+{
+    if (r->active) {
+        unindex_data(r);
+        r->active = false;
+    }
+}
+
+void set_reg(int epfd, int fd, uint32_t events, uint64_t data)
+{
+    struct reg *r = find_reg(epfd, fd, true);
+    if (r == NULL) {
+        dropped++;
+        return;
+    }
+    if (r->active) {
+        unindex_data(r);
+    }
+    // The data may have belonged to an fd that was closed, and we missed
+    // that it went away
+    struct reg *old = lookup_data(epfd, data);
+    if (old != NULL) {
+        remove_reg(old);
+    }
+    r->events = events;
+    r->data = data;
+    r->active = true;
+    index_data(r);
+}
+
+bool known_epfd(int epfd)
+{
+    for (int i = 0; i < nepfds; i++) {
+        if (epfds[i] == epfd) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void add_epfd(int epfd)
+{
+    if (nepfds < MAX_EPFDS) {
+        epfds[nepfds++] = epfd;
+    }
+}
+
+/* Reads the registrations made before we attached */
+void load_epfd(int epfd)
+{
+    if (known_epfd(epfd)) {
+        return;
+    }
+    add_epfd(epfd);
+
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/fdinfo/%d", pid, epfd);
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        return;
+    }
+    char line[256];
+    while (fgets(line, sizeof(line), f) != NULL) {
+        int fd;
+        unsigned int events;
+        unsigned long long data;
+        if (sscanf(line, "tfd: %d events: %x data: %llx",
+                   &fd, &events, &data) == 3) {
+            set_reg(epfd, fd, events, data);
+        }
+    }
+    fclose(f);
+}
+
+/*
+ * Closing an fd removes it from the epoll fds, unless it has been
+ * duplicated, which we don't follow.
+ */
+void close_fd(int fd)
+{
+    for (int i = 0; i < nepfds; i++) {
+        struct reg *r = find_reg(epfds[i], fd, false);
+        if (r != NULL) {
+            remove_reg(r);
+        }
+    }
+}
+
+/* A new epoll fd may reuse the number of one that was closed */
+void new_epfd(int epfd)
+{
+    for (int i = 0; i < nregs; i++) {
+        if (regs[i].epfd == epfd) {
+            remove_reg(&regs[i]);
+        }
+    }
+    if (!known_epfd(epfd)) {
+        add_epfd(epfd);
+    }
+}
+
+/* Event loops */
+
+struct task *find_task(pid_t tid, bool create)
+{
+    for (int i = 0; i < ntasks; i++) {
+        if (tasks[i].tid == tid) {
+            return &tasks[i];
+        }
+    }
+    if (!create || ntasks == MAX_TASKS) {
+        return NULL;
+    }
+    memset(&tasks[ntasks], 0, sizeof(tasks[ntasks]));
+    tasks[ntasks].tid = tid;
+    tasks[ntasks].nr = -1;
+    return &tasks[ntasks++];
+}
+
+struct loop *get_loop(struct task *t)
+{
+    if (t->loop != NULL || nloops == MAX_LOOPS) {
+        return t->loop;
+    }
+    struct loop *l = &loops[nloops++];
+    l->tid = t->tid;
+
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/task/%d/comm", pid, t->tid);
+    FILE *f = fopen(path, "r");
+    if (f != NULL) {
+        if (fgets(l->comm, sizeof(l->comm), f) != NULL) {
+            l->comm[strcspn(l->comm, "\n")] = '\0';
+        }
+        fclose(f);
+    }
+    t->loop = l;
+    return l;
+}
+
+int log2_bucket(unsigned long value, int buckets)
+{
+    int bucket = 0;
+    while (value > 1 && bucket < buckets - 1) {
+        value >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+/*
+ * Whether the wait would block at all, false for a zero timeout. This
+ * has to be called at syscall-entry, since select, pselect6 and ppoll
+ * overwrite the timeout with the time that was left.
+ */
+bool blocking(struct task *t)
+{
+    uint64_t addr;
+    switch (t->nr) {
+    case SYS_epoll_wait:
+    case SYS_epoll_pwait:
+        return (int)t->args[3] != 0;
+    case SYS_poll:
+        return (int)t->args[2] != 0;
+    case SYS_epoll_pwait2:
+    case SYS_select:
+    case SYS_pselect6:
+        addr = t->args[t->nr == SYS_epoll_pwait2 ? 3 : 4];
+        break;
+    default:
+        addr = t->args[2];
+        break;
+    }
+    // A timespec or, for select, a timeval, NULL means forever
+    long timeout[2];
+    if (addr == 0 || !read_memory(t->tid, addr, timeout, sizeof(timeout))) {
+        return true;
+    }
+    return timeout[0] != 0 || timeout[1] != 0;
+}
+
+void add_ready(struct loop *l, int fd, uint32_t events)
+{
+    if (l->nready < MAX_READY) {
+        l->ready[l->nready].fd = fd;
+        l->ready[l->nready].events = events;
+        l->ready[l->nready].state = UNTOUCHED;
+        l->nready++;
+    }
+}
+
+struct ready *find_ready(struct loop *l, int fd)
+{
+    for (int i = 0; i < l->nready; i++) {
+        if (l->ready[i].fd == fd) {
+            return &l->ready[i];
+        }
+    }
+    return NULL;
+}
+
+/* Collects the ready fds from the result of the wait */
+void read_ready(struct task *t, struct loop *l, int count)
+{
+    if (is_epoll(t->nr)) {
+        static struct epoll_event events[MAX_READY];
+        int n = count < MAX_READY ? count : MAX_READY;
+        int epfd = t->args[0];
+        load_epfd(epfd);
+        if (!read_memory(t->tid, t->args[1], events, n * sizeof(events[0]))) {
+            l->unknown = true;
+            return;
+        }
+        for (int i = 0; i < n; i++) {
+            struct reg *r = lookup_data(epfd, events[i].data.u64);
+            l->epoll_events++;
+            if (r == NULL) {
+                l->unknown = true;
+                continue;
+            }
+            l->edge_events += (r->events & EPOLLET) != 0;
+            add_ready(l, r->fd, events[i].events);
+        }
+    } else if (t->nr == SYS_poll || t->nr == SYS_ppoll) {
+        static struct pollfd fds[MAX_POLLFDS];
+        int n = t->args[1] < MAX_POLLFDS ? (int)t->args[1] : MAX_POLLFDS;
+        if (!read_memory(t->tid, t->args[0], fds, n * sizeof(fds[0]))) {
+            l->unknown = true;
+            return;
+        }
+        for (int i = 0; i < n; i++) {
+            if (fds[i].fd >= 0 && fds[i].revents != 0) {
+                add_ready(l, fds[i].fd, fds[i].revents);
+            }
+        }
+    } else {
+        // select rewrites the sets in place to the ready fds
+        int nfds = t->args[0] < FD_SETSIZE ? (int)t->args[0] : FD_SETSIZE;
+        uint32_t kinds[3] = { EPOLLIN, EPOLLOUT, EPOLLPRI };
+        fd_set sets[3];
+        for (int k = 0; k < 3; k++) {
+            FD_ZERO(&sets[k]);
+            // Only the words that cover nfds are written back
+            size_t size = (nfds + 63) / 64 * 8;
+            if (t->args[k + 1] != 0 &&
+                !read_memory(t->tid, t->args[k + 1], &sets[k], size)) {
+                l->unknown = true;
+            }
+        }
+        for (int fd = 0; fd < nfds; fd++) {
+            uint32_t events = 0;
+            for (int k = 0; k < 3; k++) {
+                if (FD_ISSET(fd, &sets[k])) {
+                    events |= kinds[k];
+                }
+            }
+            if (events != 0) {
+                add_ready(l, fd, events);
+            }
+        }
+    }
+}
+
+void wait_entry(struct task *t)
+{
+    struct loop *l = get_loop(t);
+    if (l == NULL) {
+        return;
+    }
+    if (l->last_exit > 0) {
+        double busy = t->entry_time - l->last_exit;
+        l->busy_time += busy;
+        if (l->nready > 0 || l->unknown) {
+            l->handled++;
+            l->handler_times[log2_bucket(busy * 1e3, TIME_BUCKETS)]++;
+            if (busy > l->max_handler) {
+                l->max_handler = busy;
+            }
+            if (!l->useful && !l->unknown) {
+                l->wasted++;
+            }
+        }
+    }
+}
+
+void wait_exit(struct task *t, int64_t ret)
+{
+    double now = now_ms();
+    struct loop *l = t->loop;
+    if (l == NULL) {
+        return;
+    }
+    l->waits++;
+    l->wait_time += now - t->entry_time;
+    l->last_exit = now;
+
+    // Remember what was left untouched by the last round
+    struct ready old[MAX_READY];
+    int nold = 0;
+    for (int i = 0; i < l->nready; i++) {
+        if (l->ready[i].state == UNTOUCHED) {
+            old[nold++] = l->ready[i];
+        }
+    }
+    l->nready = 0;
+    l->unknown = false;
+    l->useful = false;
+
+    if (ret < 0) {
+        l->interrupted += ret == -EINTR;
+    } else if (ret == 0) {
+        if (t->blocks) {
+            l->timeouts++;
+        } else {
+            l->polls++;
+        }
+    } else {
+        l->wakeups++;
+        l->events += ret;
+        l->batches[log2_bucket(ret, BATCH_BUCKETS)]++;
+        if (is_epoll(t->nr)) {
+            if ((int)t->args[2] > l->maxevents) {
+                l->maxevents = t->args[2];
+            }
+            l->full += ret == (int)t->args[2];
+        }
+        read_ready(t, l, ret);
+        for (int i = 0; i < nold; i++) {
+            l->repeats += find_ready(l, old[i].fd) != NULL;
+        }
+    }
+
+    if (verbose) {
+        printf("[%d] %s = %lld <%.3f ms>", t->tid, wait_name(t->nr),
+               (long long)ret, now - t->entry_time);
+        for (int i = 0; i < l->nready; i++) {
+            printf(" %d:%#x", l->ready[i].fd, l->ready[i].events);
+        }
+        printf("%s\n", l->unknown ? " ?" : "");
+    }
+}
+
+void ctl_entry(struct task *t)
+{
+    int op = t->args[1];
+    t->ctl_event_ok = op != EPOLL_CTL_DEL &&
+        read_memory(t->tid, t->args[3], &t->ctl_event, sizeof(t->ctl_event));
+}
+
+void ctl_exit(struct task *t, int64_t ret)
+{
+    int epfd = t->args[0];
+    int op = t->args[1];
+    int fd = t->args[2];
+    struct loop *l = get_loop(t);
+    if (l != NULL) {
+        l->ctl_add += op == EPOLL_CTL_ADD;
+        l->ctl_mod += op == EPOLL_CTL_MOD;
+        l->ctl_del += op == EPOLL_CTL_DEL;
+    }
+    if (ret != 0) {
+        return;
+    }
+
+    // Load the older registrations first, or they would override this one
+    load_epfd(epfd);
+    if (op == EPOLL_CTL_DEL) {
+        struct reg *r = find_reg(epfd, fd, false);
+        if (r != NULL) {
+            remove_reg(r);
+        }
+    } else if (t->ctl_event_ok) {
+        set_reg(epfd, fd, t->ctl_event.events, t->ctl_event.data.u64);
+    }
+}
+
+void io_exit(struct task *t, int64_t ret)
+{
+    struct loop *l = t->loop;
+    if (l == NULL) {
+        return;
+    }
+    struct ready *r = find_ready(l, t->args[0]);
+    if (r == NULL) {
+        l->eagain_other += ret == -EAGAIN;
+        return;
+    }
+    l->io_ready++;
+    if (ret == -EAGAIN) {
+        if (r->state == UNTOUCHED) {
+            r->state = SPURIOUS;
+            l->spurious++;
+        } else {
+            l->drained++;
+        }
+    } else {
+        // An error such as ECONNRESET is handling the fd too
+        r->state = PROGRESS;
+        l->useful = true;
+    }
+}
+
+void syscall_stop(struct task *t)
+{
+    struct __ptrace_syscall_info info;
+    if (ptrace(PTRACE_GET_SYSCALL_INFO, t->tid, sizeof(info), &info) == -1) {
+        return;
+    }
+    if (info.op == PTRACE_SYSCALL_INFO_ENTRY) {
+        t->nr = info.entry.nr;
+        memcpy(t->args, info.entry.args, sizeof(t->args));
+        t->entry_time = now_ms();
+        if (is_wait(t->nr)) {
+            t->blocks = blocking(t);
+            wait_entry(t);
+        } else if (t->nr == SYS_epoll_ctl) {
+            ctl_entry(t);
+        }
+    } else if (info.op == PTRACE_SYSCALL_INFO_EXIT && t->nr != -1) {
+        int64_t ret = info.exit.rval;
+        if (is_wait(t->nr)) {
+            wait_exit(t, ret);
+        } else if (t->nr == SYS_epoll_ctl) {
+            ctl_exit(t, ret);
+        } else if (is_io(t->nr)) {
+            io_exit(t, ret);
+        } else if ((t->nr == SYS_epoll_create ||
+                    t->nr == SYS_epoll_create1) && ret >= 0) {
+            new_epfd(ret);
+        } else if (t->nr == SYS_close && ret == 0) {
+            close_fd(t->args[0]);
+        } else if ((t->nr == SYS_dup2 || t->nr == SYS_dup3) && ret >= 0 &&
+                   t->args[1] != t->args[0]) {
+            // The target fd was closed first
+            close_fd(t->args[1]);
+        }
+        t->nr = -1;
+    }
+}
+
+int attach_threads(void)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/task", pid);
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+
+    int found = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        pid_t tid = atoi(entry->d_name);
+        if (tid <= 0 || find_task(tid, false) != NULL) {
+            continue;
+        }
+        long options = PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE;
+        if (ptrace(PTRACE_SEIZE, tid, 0, options) == -1 ||
+            ptrace(PTRACE_INTERRUPT, tid, 0, 0) == -1) {
+            continue;
+        }
+        find_task(tid, true);
+        found++;
+    }
+    closedir(dir);
+    return found;
+}
+
+/* Report */
+
+double percentile(struct loop *l, double fraction)
+{
+    unsigned long seen = 0;
+    for (int i = 0; i < TIME_BUCKETS; i++) {
+        seen += l->handler_times[i];
+        if (seen >= fraction * l->handled) {
+            return 1UL << (i + 1);
+        }
+    }
+    return 0;
+}
+
+double ratio(double a, double b)
+{
+    return b > 0 ? (double)a / b : 0.0;
+}
+
+void print_hints(struct loop *l, int active)
+{
+    unsigned long ctl = l->ctl_add + l->ctl_mod + l->ctl_del;
+    double busy = ratio(l->busy_time, l->busy_time + l->wait_time);
+    if (l->wakeups + l->timeouts > 100 && busy > 0.9) {
+        printf("  hint: busy %.0f%% of the time, the loop is saturated;"
+               " spread the fds over more loops\n", busy * 100);
+    } else if (active > 1 && l->wakeups > 100 && busy < 0.1 &&
+               ratio(l->events, l->wakeups) < 1.5) {
+        printf("  hint: mostly idle with single events;"
+               " fewer loops would batch more\n");
+    }
+    if (ratio(l->full, l->wakeups) > 0.1) {
+        printf("  hint: %.0f%% of wakeups fill maxevents;"
+               " raise maxevents\n", ratio(l->full, l->wakeups) * 100);
+    }
+    if (l->polls > l->wakeups + l->timeouts) {
+        printf("  hint: mostly non-blocking waits,"
+               " the loop is polling instead of sleeping\n");
+    }
+    if (l->wakeups > 100 && ratio(ctl, l->wakeups) >= 1) {
+        printf("  hint: %.1f epoll_ctl per wakeup;"
+               " edge-triggered fds don't need to be re-armed\n",
+               ratio(ctl, l->wakeups));
+    }
+    if (ratio(l->spurious, l->io_ready) > 0.05) {
+        printf("  hint: %.0f%% of I/O on ready fds finds nothing;"
+               " several threads wake for the same fds, try EPOLLEXCLUSIVE"
+               " or one epoll fd per thread\n",
+               ratio(l->spurious, l->io_ready) * 100);
+    }
+    if (ratio(l->repeats, l->events) > 0.1) {
+        printf("  hint: %.0f%% of events are for fds left untouched since"
+               " the last wakeup; drain them, or use edge-triggered"
+               " mode\n", ratio(l->repeats, l->events) * 100);
+    }
+}
+
+void print_loop(struct loop *l, int active)
+{
+    printf("\nThread %d (%s)\n", l->tid, l->comm);
+    printf("  waits       %lu: %lu with events, %lu timed out,"
+           " %lu non-blocking, %lu interrupted\n", l->waits, l->wakeups,
+           l->timeouts, l->polls, l->interrupted);
+    double total = l->wait_time + l->busy_time;
+    printf("  time        %.3f ms, %.1f%% waiting, %.1f%% handling\n",
+           total, ratio(l->wait_time, total) * 100,
+           ratio(l->busy_time, total) * 100);
+    if (l->wakeups == 0) {
+        return;
+    }
+
+    printf("  batch size  avg %.2f", ratio(l->events, l->wakeups));
+    if (l->maxevents > 0) {
+        printf(", %lu full (maxevents %d)", l->full, l->maxevents);
+    }
+    printf("\n");
+    unsigned long most = 0;
+    for (int i = 0; i < BATCH_BUCKETS; i++) {
+        if (l->batches[i] > most) {
+            most = l->batches[i];
+        }
+    }
+    for (int i = 0; i < BATCH_BUCKETS; i++) {
+        if (l->batches[i] == 0) {
+            continue;
+        }
+        char range[32];
+        if (i == 0) {
+            snprintf(range, sizeof(range), "1");
+        } else if (i == BATCH_BUCKETS - 1) {
+            snprintf(range, sizeof(range), "%d+", 1 << i);
+        } else {
+            snprintf(range, sizeof(range), "%d-%d", 1 << i, (2 << i) - 1);
+        }
+        int width = 40 * l->batches[i] / most;
+        printf("  %14s %-40.*s %lu\n", range, width > 0 ? width : 1,
+               "########################################", l->batches[i]);
+    }
+
+    printf("  handler us  p50 <= %.0f, p90 <= %.0f, p99 <= %.0f, max %.1f\n",
+           percentile(l, 0.5), percentile(l, 0.9), percentile(l, 0.99),
+           l->max_handler * 1e3);
+    unsigned long ctl = l->ctl_add + l->ctl_mod + l->ctl_del;
+    printf("  epoll_ctl   %.2f per wakeup: %lu add, %lu mod, %lu del\n",
+           ratio(ctl, l->wakeups), l->ctl_add, l->ctl_mod, l->ctl_del);
+    if (l->epoll_events > 0) {
+        printf("  triggering  %.1f%% of events edge-triggered",
+               ratio(l->edge_events, l->epoll_events) * 100);
+    } else {
+        printf("  triggering  level-triggered");
+    }
+    printf(", %lu for fds untouched since the last wakeup\n", l->repeats);
+    printf("  I/O         %lu calls on ready fds, %lu EAGAIN first (spurious),"
+           " %lu EAGAIN after progress, %lu EAGAIN on other fds\n",
+           l->io_ready, l->spurious, l->drained, l->eagain_other);
+    printf("  wasted      %lu wakeups (%.1f%%) without successful I/O"
+           " on a ready fd\n", l->wasted,
+           ratio(l->wasted, l->handled) * 100);
+    print_hints(l, active);
+}
+
+int compare_waits(const void *a, const void *b)
+{
+    const struct loop *x = a, *y = b;
+    return x->waits < y->waits ? 1 : x->waits > y->waits ? -1 : 0;
+}
+
+void report(void)
+{
+    // The loop pointers of the tasks are not needed anymore
+    qsort(loops, nloops, sizeof(loops[0]), compare_waits);
+    int active = 0;
+    for (int i = 0; i < nloops; i++) {
+        active += loops[i].wakeups > 0;
+    }
+    for (int i = 0; i < nloops && loops[i].waits > 0; i++) {
+        print_loop(&loops[i], active);
+    }
+    if (nloops == 0 || loops[0].waits == 0) {
+        printf("\nNo thread waited on epoll, poll or select\n");
+    }
+    if (dropped > 0) {
+        printf("\n%lu epoll registrations not followed, too many fds\n",
+               dropped);
+    }
+}
+
+void on_interrupt(int sig)
+{
+    (void)sig;
+    interrupted = 1;
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "v")) != -1) {
+        switch (opt) {
+        case 'v':
+            verbose = true;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (argc - optind != 1) {
+        usage(argv[0]);
+    }
+    pid = atoi(argv[optind]);
+    if (pid <= 0) {
+        usage(argv[0]);
+    }
+
+    memset(reg_by_fd, -1, sizeof(reg_by_fd));
+    memset(reg_by_data, -1, sizeof(reg_by_data));
+
+    // No SA_RESTART, so that waitpid returns with EINTR
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_interrupt;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    while (attach_threads() > 0) {
+    }
+    if (ntasks == 0) {
+        fprintf(stderr, "Could not attach to %d\n", pid);
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stderr, "Attached to %d threads, press Ctrl-C to stop\n", ntasks);
+
+    while (!interrupted) {
+        int status;
+        pid_t tid = waitpid(-1, &status, __WALL);
+        if (tid == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        if (WIFEXITED(status) || WIFSIGNALED(status)) {
+            struct task *t = find_task(tid, false);
+            if (t != NULL) {
+                *t = tasks[--ntasks];
+            }
+            continue;
+        }
+
+        struct task *t = find_task(tid, true);
+        int sig = WSTOPSIG(status);
+        int event = status >> 16;
+        int inject = 0;
+        if (event == PTRACE_EVENT_STOP) {
+            if (sig != SIGTRAP) {
+                ptrace(PTRACE_LISTEN, tid, 0, 0);
+                continue;
+            }
+        } else if (sig == (SIGTRAP | 0x80)) {
+            if (t != NULL) {
+                syscall_stop(t);
+            }
+        } else if (event == 0) {
+            inject = sig;
+        }
+        ptrace(PTRACE_SYSCALL, tid, 0, inject);
+    }
+
+    // The tracees are detached and resumed when we exit
+    report();
+    return 0;
+}